@@ -0,0 +1,154 @@
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ELB {
+
+BufferPool &BufferPool::instance() {
+	static BufferPool pool;
+	return pool;
+}
+
+BufferPool::BufferPool() {
+	// An eighth of the memory by default, about the buffers of one large
+	// frame on small machines. An eighth of the memory cap where there is one.
+	// trim() keeps it to the buffers of one frame between frames.
+	m_limit = (size_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 8;
+}
+
+void BufferPool::setHugePages(bool hugePages) {
+	m_hugePages = hugePages;
+}
+
+void BufferPool::setLimit(size_t limit) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_limit = limit;
+}
+
+size_t BufferPool::sizeClass(size_t size) const {
+	size_t granule = s_minPooled / 8;
+	while ( granule * 16 <= size ) {
+		granule *= 2;
+	}
+	size = (size + granule - 1) / granule * granule;
+	if ( m_hugePages ) {
+		size = (size + s_hugePageSize - 1) / s_hugePageSize * s_hugePageSize;
+	}
+	return size;
+}
+
+void BufferPool::trim() {
+	std::vector<std::pair<void *, size_t>> unmap;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t keep = std::min(m_limit, m_peak);
+		// Largest classes first, they free the most for every munmap()
+		for ( auto it=m_free.rbegin(); it!=m_free.rend(); it++ ) {
+			bool used = m_used.count(it->first) > 0;
+			while ( ! it->second.empty() && ( ! used || m_cached > keep ) ) {
+				unmap.emplace_back(it->second.back(), it->first);
+				it->second.pop_back();
+				m_cached -= it->first;
+			}
+		}
+		m_used.clear();
+		m_peak = m_inUse;
+	}
+	for ( auto &buffer : unmap ) {
+		munmap(buffer.first, buffer.second);
+	}
+}
+
+void *BufferPool::acquire(size_t size) {
+	size_t bytes = sizeClass(size);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_used.insert(bytes);
+		m_inUse += bytes;
+		m_peak = std::max(m_peak, m_inUse);
+		auto it = m_free.find(bytes);
+		if ( it != m_free.end() && ! it->second.empty() ) {
+			void *buffer = it->second.back();
+			it->second.pop_back();
+			m_cached -= bytes;
+			return buffer;
+		}
+	}
+	void *buffer = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( buffer == MAP_FAILED ) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_inUse -= bytes;
+		throw std::bad_alloc();
+	}
+	if ( m_hugePages ) {
+		madvise(buffer, bytes, MADV_HUGEPAGE);
+	}
+	return buffer;
+}
+
+void BufferPool::release(void *buffer, size_t size) {
+	size_t bytes = sizeClass(size);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_inUse -= bytes;
+		if ( m_cached + bytes <= m_limit ) {
+			m_free[bytes].push_back(buffer);
+			m_cached += bytes;
+			return;
+		}
+	}
+	munmap(buffer, bytes);
+}
+
+// Same as OpenCV's own allocator apart from where large buffers come from
+cv::UMatData *BufferPool::allocate(int dims, const int *sizes, int type, void *data,
+		size_t *step, cv::AccessFlag, cv::UMatUsageFlags) const {
+	size_t total = CV_ELEM_SIZE(type);
+	for ( int ii=dims-1; ii>=0; ii-- ) {
+		if ( step ) {
+			if ( data && step[ii] != CV_AUTOSTEP ) {
+				total = step[ii];
+			} else {
+				step[ii] = total;
+			}
+		}
+		total *= sizes[ii];
+	}
+	cv::UMatData *u = new cv::UMatData(this);
+	u->size = total;
+	if ( data ) {
+		u->data = u->origdata = (uchar *) data;
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+	} else if ( total >= s_minPooled ) {
+		// The interface is const, the pool obviously isn't
+		u->data = u->origdata = (uchar *) const_cast<BufferPool *>(this)->acquire(total);
+	} else {
+		u->data = u->origdata = (uchar *) cv::fastMalloc(total);
+	}
+	return u;
+}
+
+bool BufferPool::allocate(cv::UMatData *data, cv::AccessFlag, cv::UMatUsageFlags) const {
+	return data != NULL;
+}
+
+void BufferPool::deallocate(cv::UMatData *u) const {
+	if ( u == NULL ) {
+		return;
+	}
+	if ( ! ( u->flags & cv::UMatData::USER_ALLOCATED ) ) {
+		if ( u->size >= s_minPooled ) {
+			const_cast<BufferPool *>(this)->release(u->origdata, u->size);
+		} else {
+			cv::fastFree(u->origdata);
+		}
+		u->origdata = NULL;
+	}
+	delete u;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace ELB {
+
+	// Keeps large buffers after they are freed and hands them out again for
+	// the next frame, which is usually of the same size. Requests are rounded
+	// up to size classes an eighth of a power of two apart, so frames of
+	// slightly different size share buffers as well. Small requests and
+	// anything beyond the cache limit go straight to the system. Between
+	// frames no more than the buffers of the last frame are kept, see
+	// trim().
+	//
+	// Installed as OpenCV's default allocator it serves every cv::Mat.
+	class BufferPool : public cv::MatAllocator {
+		public:
+			static BufferPool &instance();
+
+			// Backs pooled buffers with transparent huge pages, has to be set
+			// before the first allocation
+			void setHugePages(bool hugePages);
+			// Bytes of free buffers that are kept at most
+			void setLimit(size_t limit);
+			// Called once a frame is done. Unmaps the free buffers of size
+			// classes the frame didn't ask for, and of the others whatever
+			// is beyond the most the frame had out of the pool at once.
+			void trim();
+
+			// Page aligned buffer of at least size bytes, to be given back
+			// with the same size
+			void *acquire(size_t size);
+			void release(void *buffer, size_t size);
+
+			cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+					size_t *step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+			bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags,
+					cv::UMatUsageFlags usageFlags) const override;
+			void deallocate(cv::UMatData *data) const override;
+		private:
+			static constexpr size_t s_minPooled = 1 << 20;
+			static constexpr size_t s_hugePageSize = 2 << 20;
+
+			BufferPool();
+			size_t sizeClass(size_t size) const;
+
+			std::mutex m_mutex;
+			std::map<size_t, std::vector<void *>> m_free;
+			size_t m_cached = 0;
+			// Bytes handed out and not given back yet, and their peak and
+			// the size classes asked for since the last trim()
+			size_t m_inUse = 0;
+			size_t m_peak = 0;
+			std::set<size_t> m_used;
+			size_t m_limit = 0;
+			bool m_hugePages = false;
+	};
+}
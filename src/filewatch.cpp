@@ -0,0 +1,130 @@
+#include "filewatch.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ELB {
+
+using namespace std::chrono_literals;
+
+namespace {
+
+const long s_blockSize = 2880;
+const long s_cardSize = 80;
+
+long roundUp(long size) {
+	return (size + s_blockSize - 1) / s_blockSize * s_blockSize;
+}
+
+}
+
+bool isCompleteFits(const std::string &fname) {
+	int fd = open(fname.c_str(), O_RDONLY);
+	if ( fd < 0 ) {
+		return false;
+	}
+	struct stat info;
+	if ( fstat(fd, &info) != 0 ) {
+		close(fd);
+		return false;
+	}
+	char block[s_blockSize];
+	long bitpix = 0, naxis = 0, pcount = 0, gcount = 1, product = 1;
+	long headerSize = -1;
+	for ( off_t offset=0; headerSize < 0; offset+=s_blockSize ) {
+		if ( pread(fd, block, s_blockSize, offset) != s_blockSize ) {
+			// Header not written yet
+			close(fd);
+			return false;
+		}
+		if ( offset == 0 && memcmp(block, "SIMPLE  =", 9) != 0 ) {
+			close(fd);
+			return true;
+		}
+		for ( long ii=0; ii<s_blockSize; ii+=s_cardSize ) {
+			const char *card = block + ii;
+			std::string key(card, 8);
+			key.erase(key.find_last_not_of(' ') + 1);
+			if ( key == "END" ) {
+				headerSize = offset + s_blockSize;
+				break;
+			}
+			if ( card[8] != '=' ) {
+				continue;
+			}
+			long value = atol(std::string(card + 10, s_cardSize - 10).c_str());
+			if ( key == "BITPIX" ) {
+				bitpix = value;
+			} else if ( key == "NAXIS" ) {
+				naxis = value;
+			} else if ( key == "PCOUNT" ) {
+				pcount = value;
+			} else if ( key == "GCOUNT" ) {
+				gcount = value;
+			} else if ( key.compare(0, 5, "NAXIS") == 0 ) {
+				product *= value;
+			}
+		}
+	}
+	close(fd);
+	long dataSize = naxis == 0 ? 0 : labs(bitpix) / 8 * gcount * (pcount + product);
+	return info.st_size >= headerSize + roundUp(dataSize);
+}
+
+bool waitUntilWritten(const std::string &fname, std::chrono::milliseconds timeout,
+		std::chrono::milliseconds &waited) {
+	auto start = std::chrono::steady_clock::now();
+	// Watch before checking, otherwise closing in between would be missed
+	int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	int wd = fd < 0 ? -1 : inotify_add_watch(fd, fname.c_str(), IN_CLOSE_WRITE | IN_MODIFY);
+	bool ready = false;
+	while ( ! ready ) {
+		if ( isCompleteFits(fname) ) {
+			ready = true;
+			break;
+		}
+		auto remaining = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start);
+		if ( remaining <= 0ms ) {
+			break;
+		}
+		if ( wd < 0 && fd >= 0 ) {
+			wd = inotify_add_watch(fd, fname.c_str(), IN_CLOSE_WRITE | IN_MODIFY);
+		}
+		if ( wd < 0 ) {
+			// No inotify or the file doesn't exist yet
+			std::this_thread::sleep_for(std::min(remaining, std::chrono::milliseconds(10)));
+			continue;
+		}
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if ( poll(&pfd, 1, remaining.count()) <= 0 ) {
+			continue;
+		}
+		alignas(struct inotify_event) char buffer[4096];
+		ssize_t length;
+		while ( (length = read(fd, buffer, sizeof(buffer))) > 0 ) {
+			for ( char *ptr = buffer; ptr < buffer + length; ) {
+				struct inotify_event *event = (struct inotify_event *) ptr;
+				if ( event->mask & IN_CLOSE_WRITE ) {
+					ready = true;
+				}
+				ptr += sizeof(struct inotify_event) + event->len;
+			}
+		}
+	}
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start);
+	return ready;
+}
+
+}
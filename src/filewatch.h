@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+namespace ELB {
+
+	// Whether the primary HDU of the file is completely on disk, judged by
+	// the sizes given in its header. Files that don't look like plain FITS
+	// are considered complete.
+	bool isCompleteFits(const std::string &fname);
+	// Blocks until the file is complete or its writer closed it, using
+	// inotify, but at most timeout. Returns whether the file is ready and
+	// stores the time spent waiting in waited.
+	bool waitUntilWritten(const std::string &fname, std::chrono::milliseconds timeout,
+			std::chrono::milliseconds &waited);
+}
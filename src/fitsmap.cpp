@@ -0,0 +1,203 @@
+#include "fitsmap.h"
+#include "simd.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+namespace ELB {
+
+namespace {
+
+// Big-endian to native byte order, rare enough to not need a vector version
+void swap64(const uint8_t *src, uint64_t *dst, long n) {
+	for ( long ii=0; ii<n; ii++ ) {
+		uint64_t value = 0;
+		for ( int bb=0; bb<8; bb++ ) {
+			value = (value << 8) | src[8*ii + bb];
+		}
+		dst[ii] = value;
+	}
+}
+
+}
+
+std::unique_ptr<FitsMap> FitsMap::view(const uint8_t *data, size_t size) {
+	if ( size < (size_t) s_blockSize ) {
+		return nullptr;
+	}
+	std::unique_ptr<FitsMap> map(new FitsMap());
+	map->m_base = data;
+	map->m_size = size;
+	if ( ! map->parseHeader() ) {
+		return nullptr;
+	}
+	return map;
+}
+
+// Only the keywords describing the data are needed here. Anything but a
+// single 2D image in the primary HDU is rejected and handled by cfitsio.
+bool FitsMap::parseHeader() {
+	if ( memcmp(m_base, "SIMPLE  =", 9) != 0 ) {
+		return false;
+	}
+	bool simple = false;
+	long naxis = 0, naxis3 = 1;
+	size_t offset = 0;
+	for ( ; offset + s_cardSize <= m_size; offset += s_cardSize ) {
+		const char *card = (const char *) m_base + offset;
+		std::string key(card, 8);
+		key.erase(key.find_last_not_of(' ') + 1);
+		if ( key == "END" ) {
+			break;
+		}
+		if ( card[8] != '=' ) {
+			continue;
+		}
+		std::string value(card + 10, s_cardSize - 10);
+		if ( key == "SIMPLE" ) {
+			size_t pos = value.find_first_not_of(' ');
+			simple = pos != std::string::npos && value[pos] == 'T';
+		} else if ( key == "BITPIX" ) {
+			m_bitpix = atoi(value.c_str());
+		} else if ( key == "NAXIS" ) {
+			naxis = atol(value.c_str());
+		} else if ( key == "NAXIS1" ) {
+			m_naxis1 = atol(value.c_str());
+		} else if ( key == "NAXIS2" ) {
+			m_naxis2 = atol(value.c_str());
+		} else if ( key == "NAXIS3" ) {
+			naxis3 = atol(value.c_str());
+		} else if ( key == "BZERO" ) {
+			m_bzero = strtod(value.c_str(), NULL);
+		} else if ( key == "BSCALE" ) {
+			m_bscale = strtod(value.c_str(), NULL);
+		}
+	}
+	if ( offset + s_cardSize > m_size || ! simple ) {
+		return false;
+	}
+	if ( naxis != 2 && ! ( naxis == 3 && naxis3 == 1 ) ) {
+		return false;
+	}
+	if ( m_bitpix != BYTE_IMG && m_bitpix != SHORT_IMG && m_bitpix != LONG_IMG
+			&& m_bitpix != FLOAT_IMG && m_bitpix != DOUBLE_IMG ) {
+		return false;
+	}
+	m_bytes = abs(m_bitpix) / 8;
+	size_t dataStart = (offset / s_blockSize + 1) * s_blockSize;
+	if ( m_naxis1 <= 0 || m_naxis2 <= 0
+			|| dataStart + (size_t) m_naxis1 * m_naxis2 * m_bytes > m_size ) {
+		return false;
+	}
+	m_pixels = m_base + dataStart;
+	return true;
+}
+
+int FitsMap::bitpix() const {
+	return m_bitpix;
+}
+
+long FitsMap::naxis1() const {
+	return m_naxis1;
+}
+
+long FitsMap::naxis2() const {
+	return m_naxis2;
+}
+
+double FitsMap::bzero() const {
+	return m_bzero;
+}
+
+double FitsMap::bscale() const {
+	return m_bscale;
+}
+
+void FitsMap::read_subset(int datatype, const long *fpix, const long *lpix,
+		const long *inc, void *data) const {
+	if ( fpix[0] < 1 || fpix[1] < 1 || lpix[0] > m_naxis1 || lpix[1] > m_naxis2 ) {
+		throw std::runtime_error("Requested pixels are outside of the image");
+	}
+	int outBytes = datatype == TBYTE ? 1 : datatype == TUSHORT ? 2 : 4;
+	long nPix = (lpix[0] - fpix[0]) / inc[0] + 1;
+	std::vector<uint8_t> gathered(inc[0] == 1 ? 0 : nPix * m_bytes);
+	std::vector<uint8_t> buffer(nPix * sizeof(uint64_t));
+	uint8_t *out = (uint8_t *) data;
+	for ( long row=fpix[1]; row<=lpix[1]; row+=inc[1] ) {
+		const uint8_t *src = m_pixels + ((row - 1) * m_naxis1 + fpix[0] - 1) * m_bytes;
+		if ( inc[0] != 1 ) {
+			for ( long ii=0; ii<nPix; ii++ ) {
+				memcpy(&gathered[ii * m_bytes], src + ii * inc[0] * m_bytes, m_bytes);
+			}
+			src = gathered.data();
+		}
+		convertRow(datatype, src, out, nPix, buffer.data());
+		out += nPix * outBytes;
+	}
+}
+
+// Converts nPix contiguous big-endian values, buffer has to hold nPix
+// 64 bit values
+void FitsMap::convertRow(int datatype, const uint8_t *src, uint8_t *dst,
+		long nPix, uint8_t *buffer) const {
+	bool scaled = m_bzero != 0 || m_bscale != 1;
+	if ( datatype == TBYTE && m_bitpix == BYTE_IMG && ! scaled ) {
+		memcpy(dst, src, nPix);
+		return;
+	}
+	if ( datatype == TUSHORT && m_bitpix == SHORT_IMG && m_bzero == 32768 && m_bscale == 1 ) {
+		swapBytes16(src, (uint16_t *) dst, nPix, 0x8000);
+		return;
+	}
+	if ( datatype != TFLOAT ) {
+		throw std::runtime_error("Unsupported conversion of memory mapped FITS data");
+	}
+	float *out = (float *) dst;
+	switch ( m_bitpix ) {
+		case BYTE_IMG:
+			for ( long ii=0; ii<nPix; ii++ ) {
+				out[ii] = src[ii] * m_bscale + m_bzero;
+			}
+			break;
+		case SHORT_IMG: {
+			uint16_t *raw = (uint16_t *) buffer;
+			swapBytes16(src, raw, nPix, 0);
+			for ( long ii=0; ii<nPix; ii++ ) {
+				out[ii] = (int16_t) raw[ii] * m_bscale + m_bzero;
+			}
+			break;
+		}
+		case LONG_IMG: {
+			uint32_t *raw = (uint32_t *) buffer;
+			swapBytes32(src, raw, nPix);
+			for ( long ii=0; ii<nPix; ii++ ) {
+				out[ii] = (int32_t) raw[ii] * m_bscale + m_bzero;
+			}
+			break;
+		}
+		case FLOAT_IMG: {
+			uint32_t *raw = (uint32_t *) buffer;
+			swapBytes32(src, raw, nPix);
+			memcpy(out, raw, nPix * sizeof(float));
+			if ( scaled ) {
+				for ( long ii=0; ii<nPix; ii++ ) {
+					out[ii] = out[ii] * m_bscale + m_bzero;
+				}
+			}
+			break;
+		}
+		case DOUBLE_IMG: {
+			uint64_t *raw = (uint64_t *) buffer;
+			swap64(src, raw, nPix);
+			for ( long ii=0; ii<nPix; ii++ ) {
+				double value;
+				memcpy(&value, &raw[ii], sizeof(value));
+				out[ii] = value * m_bscale + m_bzero;
+			}
+			break;
+		}
+	}
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+#include <fitsio.h>
+
+namespace ELB {
+
+	// Read only view of a plain, uncompressed FITS file in memory with the
+	// image in the primary HDU, which is what Ekos writes. The header is parsed
+	// directly and the big-endian pixels are converted on the fly, everything
+	// else is left to cfitsio.
+	class FitsMap {
+		public:
+			static constexpr long s_blockSize = 2880;
+			static constexpr long s_cardSize = 80;
+
+			// Returns nullptr if the content can't be handled by this reader.
+			// The memory, e.g. a mapped file or an inflated .fits.gz, has to
+			// outlive the view.
+			static std::unique_ptr<FitsMap> view(const uint8_t *data, size_t size);
+			FitsMap(const FitsMap &other) = delete;
+			FitsMap& operator=(const FitsMap &other) = delete;
+
+			int bitpix() const;
+			long naxis1() const;
+			long naxis2() const;
+			double bzero() const;
+			double bscale() const;
+			// Same semantics as fits_read_subset, supports TBYTE for 8 bit
+			// data, TUSHORT for unsigned 16 bit data and TFLOAT for everything
+			void read_subset(int datatype, const long *fpix, const long *lpix,
+					const long *inc, void *data) const;
+		private:
+			FitsMap() = default;
+			bool parseHeader();
+			void convertRow(int datatype, const uint8_t *src, uint8_t *dst,
+					long nPix, uint8_t *buffer) const;
+
+			const uint8_t *m_base = nullptr;
+			size_t m_size = 0;
+			const uint8_t *m_pixels = nullptr;
+			int m_bitpix = 0;
+			int m_bytes = 0;
+			long m_naxis1 = 0, m_naxis2 = 0;
+			double m_bzero = 0, m_bscale = 1;
+	};
+}
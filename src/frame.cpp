@@ -13,6 +13,106 @@ FrmMain::FrmMain(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>& refG
 		std::cout << "Setting debug" << std::endl;
 		m_debug = true;
 	}
+	if ( getenv("ELB_DECIMATE") != nullptr ) {
+		m_imageOptions.decimate = true;
+	}
+	if ( getenv("ELB_RESAMPLE_FIRST") != nullptr ) {
+		m_imageOptions.resampleFirst = true;
+	}
+	if ( getenv("ELB_DEBAYER") != nullptr && std::string(getenv("ELB_DEBAYER")) == "superpixel" ) {
+		m_imageOptions.debayer = ImageOptions::Debayer::SUPERPIXEL;
+	}
+	if ( getenv("ELB_DENOISE") != nullptr ) {
+		static std::map<std::string, ImageOptions::Denoise> modes = {
+			{ "median", ImageOptions::Denoise::MEDIAN },
+			{ "working", ImageOptions::Denoise::WORKING_MEDIAN },
+			{ "hotpixel", ImageOptions::Denoise::HOT_PIXELS },
+			{ "none", ImageOptions::Denoise::NONE },
+		};
+		if ( modes.count(getenv("ELB_DENOISE")) ) {
+			m_imageOptions.denoise = modes[getenv("ELB_DENOISE")];
+		} else {
+			std::cerr << "Unknown denoise mode " << getenv("ELB_DENOISE") << std::endl;
+		}
+	}
+	if ( getenv("ELB_STATS_SAMPLE") != nullptr ) {
+		m_imageOptions.statsStep = std::max(atol(getenv("ELB_STATS_SAMPLE")), 1L);
+	}
+	if ( getenv("ELB_READY_TIMEOUT") != nullptr ) {
+		// Given in ms
+		m_readyTimeout = std::chrono::milliseconds(atol(getenv("ELB_READY_TIMEOUT")));
+	}
+	if ( std::thread::hardware_concurrency() < 4 ) {
+		m_prefetchMode = PrefetchMode::CACHE;
+	}
+	if ( getenv("ELB_PREFETCH") != nullptr ) {
+		// 0: off, 1: page cache only, 2: decode as well
+		char *end = nullptr;
+		long mode = strtol(getenv("ELB_PREFETCH"), &end, 10);
+		if ( *getenv("ELB_PREFETCH") != '\0' && *end == '\0' && mode >= 0 && mode <= 2 ) {
+			m_prefetchMode = (PrefetchMode) mode;
+		} else {
+			std::cerr << "Unknown prefetch mode " << getenv("ELB_PREFETCH") << std::endl;
+		}
+	}
+	if ( m_prefetchMode == PrefetchMode::DECODE && ! fits_is_reentrant() ) {
+		// Decoding the next frame opens and reads it through cfitsio while
+		// the current one is still open, which needs a reentrant cfitsio
+		if ( getenv("ELB_PREFETCH") != nullptr ) {
+			std::cerr << "cfitsio is not reentrant, prefetching into the page cache only" << std::endl;
+		}
+		m_prefetchMode = PrefetchMode::CACHE;
+	}
+	if ( getenv("ELB_NOMMAP") != nullptr ) {
+		m_imageOptions.ioBackend = "cfitsio";
+	}
+	if ( getenv("ELB_IO_BACKEND") != nullptr ) {
+		// mmap, buffered, direct, uring or cfitsio
+		m_imageOptions.ioBackend = getenv("ELB_IO_BACKEND");
+		if ( m_imageOptions.ioBackend != "cfitsio" ) {
+			try {
+				IoBackend::create(m_imageOptions.ioBackend);
+			} catch ( const std::exception &e ) {
+				std::cerr << e.what() << ", using mmap" << std::endl;
+				m_imageOptions.ioBackend = "mmap";
+			}
+		}
+	}
+	if ( getenv("ELB_NO_STRETCH_CACHE") != nullptr ) {
+		m_imageOptions.stretchCache = false;
+	}
+	if ( getenv("ELB_DROP_CACHE") != nullptr ) {
+		m_imageOptions.dropCache = true;
+	}
+	// scalar, sse2, avx2 or neon, the best one the CPU supports by default
+	if ( getenv("ELB_SIMD") != nullptr && ! setSimdLevel(getenv("ELB_SIMD")) ) {
+		std::cerr << "Unknown SIMD level " << getenv("ELB_SIMD") << std::endl;
+	}
+	if ( m_debug ) {
+		std::cout << "Using " << simdLevelName() << " kernels" << std::endl;
+	}
+	// on (default), huge to back the buffers with huge pages, or off
+	std::string bufferPool = getenv("ELB_BUFFER_POOL") != nullptr ? getenv("ELB_BUFFER_POOL") : "on";
+	if ( bufferPool == "off" ) {
+		BufferPool::instance().setLimit(0);
+	} else {
+		BufferPool::instance().setHugePages(bufferPool == "huge");
+		cv::Mat::setDefaultAllocator(&BufferPool::instance());
+	}
+	if ( getenv("ELB_MEMORY_CAP") != nullptr ) {
+		// Given in MiB
+		m_imageOptions.memoryCap = atol(getenv("ELB_MEMORY_CAP")) * 1024 * 1024;
+		if ( bufferPool != "off" ) {
+			// The cached buffers come on top of the ones the frame in work
+			// uses, keep them to the same share of the cap as of the memory
+			BufferPool::instance().setLimit(m_imageOptions.memoryCap / 8);
+		}
+		// Decoding the next frame next to the current one would double the
+		// memory, unless that was asked for explicitly
+		if ( m_prefetchMode == PrefetchMode::DECODE && getenv("ELB_PREFETCH") == nullptr ) {
+			m_prefetchMode = PrefetchMode::CACHE;
+		}
+	}
 	builder->get_widget("textLog", m_tvLog);
 	builder->get_widget("labelQueueSize", m_labelQueueSize);
 	builder->get_widget("labelSuccessSize", m_labelSuccessSize);
@@ -324,7 +424,7 @@ void FrmMain::log(const std::string &msg, bool showTimestamp) {
 	return;
 }
 
-void FrmMain::processFile(const FrameData &frameData) {
+void FrmMain::processFile(Producer producer, const FrameData &frameData, std::function<FrameData()> nextFile) {
 	std::string user, key;
 	static sigc::connection conn;
 	conn.disconnect();
@@ -349,20 +449,22 @@ void FrmMain::processFile(const FrameData &frameData) {
 	}
 
 	double ra, dec;
-	FFPtr file(frameData.m_fileName);
-	try {
-		file.read_key("RA", TDOUBLE, &ra, NULL);
-	} catch ( const FFPtr::FitsError &e ) {
-		if ( e.status() == KEY_NO_EXIST ) {
-			file.resetStatus();
-			char buff[256];
-			snprintf(buff, sizeof(buff), "File %s lacks target information, ignoring\n", frameData.m_fileName.c_str());
-			log(buff);
-			return;
-		}
-		throw;
+	auto filePtr = takePrefetched(producer, frameData.m_fileName);
+	if ( ! filePtr ) {
+		filePtr = std::make_unique<FFPtr>(frameData.m_fileName, m_imageOptions);
+		filePtr->setMedian(frameData.m_median);
+		filePtr->setDetectStars(frameData.m_starCount < 0);
+	}
+	FFPtr &file = *filePtr;
+	if ( ! file.header().get("RA", ra) ) {
+		char buff[256];
+		snprintf(buff, sizeof(buff), "File %s lacks target information, ignoring\n", frameData.m_fileName.c_str());
+		log(buff);
+		return;
+	}
+	if ( ! file.header().get("DEC", dec) ) {
+		throw std::runtime_error("File has RA but no DEC");
 	}
-	file.read_key("DEC", TDOUBLE, &dec, NULL);
         if ( ! isnan(frameData.m_schedulerRa) && ! isnan(frameData.m_schedulerDec) ) {
             log("Using target information from scheduler\n");
             ra = frameData.m_schedulerRa;
@@ -370,13 +472,33 @@ void FrmMain::processFile(const FrameData &frameData) {
         } else {
             log("Target information from scheduler not available. May result in multiple targets in lightbucket\n");
         }
-	if ( file.exposure() == NAN ) {
+	if ( isnan(file.exposure()) ) {
 		char buff[256];
 		snprintf(buff, sizeof(buff), "File %s lacks exposure information, ignoring\n", frameData.m_fileName.c_str());
 		log(buff);
 		return;
 	}
 	std::string jpg64 = file.encode();
+	char buff[256];
+	if ( file.ioThroughput() > 0 ) {
+		snprintf(buff, sizeof(buff), "Read pixels through %s at %.0f MB/s\n",
+				file.ioBackend().c_str(), file.ioThroughput());
+	} else {
+		snprintf(buff, sizeof(buff), "Read pixels through %s\n", file.ioBackend().c_str());
+	}
+	log(buff);
+	if ( file.overMemoryCap() ) {
+		snprintf(buff, sizeof(buff), "Could not keep %s within the memory cap, gzip'ed and floating point Bayer frames can't be streamed\n",
+				frameData.m_fileName.c_str());
+		log(buff);
+	}
+	if ( file.stride() > 1 ) {
+		// Bayer frames are read in 2x2 cells, so that is 4/stride^2 of the
+		// pixels for them rather than 1/stride^2
+		snprintf(buff, sizeof(buff), "Decimated read with stride %ld took %.0f ms for %.1f%% of the pixels\n",
+				file.stride(), file.readTime() * 1000, file.readFraction() * 100);
+		log(buff);
+	}
 	nlohmann::json json;
 	// Nasty!
         json["plugin_version"] = "2.2.2";
@@ -416,12 +538,25 @@ void FrmMain::processFile(const FrameData &frameData) {
 		json["equipment"]["pixel_scale"] = file.scale();
 	}
 
-	if ( frameData.m_hfr != -1 && frameData.m_hfr != NAN ) {
-		json["image"]["statistics"]["hfr"] = frameData.m_hfr;
-	}
-	json["image"]["statistics"]["stars"] = frameData.m_starCount;
-	json["image"]["statistics"]["mean"] = file.initialMean();
-	json["image"]["statistics"]["median"] = frameData.m_median;
+	long starCount = frameData.m_starCount;
+	double hfr = frameData.m_hfr;
+	if ( file.starCount() >= 0 ) {
+		// Measured here, KStars didn't analyse the frame
+		starCount = file.starCount();
+		hfr = file.hfr();
+	}
+	if ( hfr != -1 && ! isnan(hfr) ) {
+		json["image"]["statistics"]["hfr"] = hfr;
+	}
+	json["image"]["statistics"]["stars"] = starCount;
+	const FrameStatistics &statistics = file.statistics();
+	json["image"]["statistics"]["mean"] = statistics.mean;
+	json["image"]["statistics"]["median"] = statistics.median;
+	json["image"]["statistics"]["mad"] = statistics.mad;
+	json["image"]["statistics"]["min"] = statistics.min;
+	json["image"]["statistics"]["max"] = statistics.max;
+	json["image"]["statistics"]["saturated"] = statistics.saturated;
+	json["image"]["statistics"]["noise"] = statistics.noise;
 	json["image"]["thumbnail"] = jpg64;
 	json["image"]["filter_name"] = file.filter();
 	json["image"]["duration"] = file.exposure();
@@ -441,6 +576,10 @@ void FrmMain::processFile(const FrameData &frameData) {
 	}
 
 	std::string jsonString = json.dump();
+	// Get the next frame going while this one is uploaded
+	if ( nextFile ) {
+		prefetch(producer, nextFile());
+	}
 	char authBuff[STRBUFF];
 	snprintf(authBuff, sizeof(authBuff), "%s:%s", user.c_str(), key.c_str());
 	std::string auth64 = macaron::Base64::Encode(authBuff);
@@ -465,6 +604,99 @@ void FrmMain::processFile(const FrameData &frameData) {
 	}
 }
 
+// Pulls the file into the page cache unless it is read past it and, if
+// there are enough cores, runs the pixel pipeline in the background. Only
+// frames that would be uploaded are decoded.
+void FrmMain::prefetch(Producer producer, const FrameData &frameData) {
+	std::string fileName = frameData.m_fileName;
+	int median = frameData.m_median;
+	// Frames KStars didn't analyse have no star count
+	bool detectStars = frameData.m_starCount < 0;
+	if ( fileName == "" || m_prefetchMode == PrefetchMode::NONE ) {
+		return;
+	}
+	// O_DIRECT reads bypass the page cache, and frames that are dropped from
+	// it after processing shouldn't be pulled in ahead of time either
+	bool hint = m_imageOptions.ioBackend != "direct" && ! m_imageOptions.dropCache;
+	int fd = hint ? ::open(fileName.c_str(), O_RDONLY) : -1;
+	if ( fd >= 0 ) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		::close(fd);
+	}
+	if ( m_prefetchMode != PrefetchMode::DECODE ) {
+		return;
+	}
+	ImageOptions options = m_imageOptions;
+	std::chrono::milliseconds timeout = m_readyTimeout;
+	// Destroyed once the lock is released
+	std::vector<PrefetchFuture> finished;
+	std::lock_guard<std::mutex> lock(m_prefetchMutex);
+	Prefetched &prefetched = m_prefetched[(int) producer];
+	if ( fileName == prefetched.m_fileName ) {
+		return;
+	}
+	retirePrefetched(prefetched.m_file, finished);
+	prefetched.m_fileName = fileName;
+	prefetched.m_file = std::async(std::launch::async, [fileName, median, detectStars, options, timeout] {
+			std::unique_ptr<FFPtr> file = nullptr;
+			try {
+				std::chrono::milliseconds waited;
+				if ( ! waitUntilWritten(fileName, timeout, waited) ) {
+					return file;
+				}
+				file = std::make_unique<FFPtr>(fileName, options);
+				file->setMedian(median);
+				file->setDetectStars(detectStars);
+				if ( file->header().has("RA") && file->header().has("EXPTIME") ) {
+					file->decode();
+				}
+			} catch ( ... ) {
+				// Will be reported when the file is processed for real
+				file = nullptr;
+			}
+			return file;
+			});
+}
+
+// The frame the producer prefetched, if it is the one asked for. Waits for
+// the decode to finish outside the lock, so the other producer isn't held up.
+std::unique_ptr<FFPtr> FrmMain::takePrefetched(Producer producer, const std::string &fileName) {
+	PrefetchFuture file;
+	std::vector<PrefetchFuture> finished;
+	{
+		std::lock_guard<std::mutex> lock(m_prefetchMutex);
+		Prefetched &prefetched = m_prefetched[(int) producer];
+		if ( prefetched.m_fileName == fileName ) {
+			file = std::move(prefetched.m_file);
+		} else {
+			retirePrefetched(prefetched.m_file, finished);
+		}
+		prefetched.m_fileName = "";
+	}
+	if ( ! file.valid() ) {
+		return nullptr;
+	}
+	return file.get();
+}
+
+// Destroying a future of std::async blocks until the task is done, so stale
+// prefetches are parked until they finished. Must be called with
+// m_prefetchMutex held, the finished ones are handed back to be destroyed
+// once it is released.
+void FrmMain::retirePrefetched(PrefetchFuture &future, std::vector<PrefetchFuture> &finished) {
+	if ( future.valid() ) {
+		m_retired.push_back(std::move(future));
+	}
+	for ( auto it=m_retired.begin(); it!=m_retired.end(); ) {
+		if ( it->wait_for(0s) == std::future_status::ready ) {
+			finished.push_back(std::move(*it));
+			it = m_retired.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
 void FrmMain::processIfPresent() {
 	char buff[512];
 	m_queueMutex.lock();
@@ -479,7 +711,14 @@ void FrmMain::processIfPresent() {
 	try {
 		snprintf(buff, sizeof(buff), "Processing file %s\n", frameData.m_fileName.c_str());
 		log(buff);
-		processFile(frameData);
+		waitForFile(frameData);
+		processFile(Producer::LIVE, frameData, [this] {
+				std::lock_guard<std::mutex> lock(m_queueMutex);
+				if ( m_fileQueue.size() == 0 ) {
+					return FrameData("", -1, 0, 0.0, NAN, NAN, NAN);
+				}
+				return m_fileQueue.front();
+				});
 		m_nSuccess.set(m_nSuccess.get()+1);
 	} catch ( const std::exception& e ) {
 		snprintf(buff, sizeof(buff), "Error processing file %s: %s\n",
@@ -492,6 +731,7 @@ void FrmMain::processIfPresent() {
 		log(buff);
 		m_nFailure.set(m_nFailure.get()+1);
 	}
+	BufferPool::instance().trim();
 	std::lock_guard<std::mutex> lock(m_queueMutex);
 	if ( m_fileQueue.size() == 0 ) {
 		// If there are files left in the queue let's pretend were still processing
@@ -499,6 +739,29 @@ void FrmMain::processIfPresent() {
 	}
 }
 
+// Captured frames may still be written when the signal arrives, especially
+// on slow cards and network mounts. Keeps track of how long we had to wait.
+void FrmMain::waitForFile(const FrameData &frameData) {
+	std::chrono::milliseconds waited;
+	bool ready = waitUntilWritten(frameData.m_fileName, m_readyTimeout, waited);
+	m_nReadyWaits++;
+	m_readyWaitTotal += waited;
+	m_readyWaitMax = std::max(m_readyWaitMax, waited);
+	char buff[512];
+	if ( ! ready ) {
+		snprintf(buff, sizeof(buff), "File %s is still incomplete after %ld ms, trying anyway\n",
+				frameData.m_fileName.c_str(), (long) waited.count());
+		log(buff);
+		return;
+	}
+	if ( waited >= 10ms ) {
+		snprintf(buff, sizeof(buff), "Waited %ld ms for %s to be written (average %.0f ms, maximum %ld ms)\n",
+				(long) waited.count(), frameData.m_fileName.c_str(),
+				(double) m_readyWaitTotal.count() / m_nReadyWaits, (long) m_readyWaitMax.count());
+		log(buff);
+	}
+}
+
 void FrmMain::runWorker() {
 	m_running.set(true);
 	m_shutdown.set(false);
@@ -527,7 +790,8 @@ void FrmMain::bulkUpload() {
 	if ( ! m_warnedBulkUpload ) {
 		m_dialog.reset(new Gtk::MessageDialog(*this,
 					"When you bulk-upload images taken in the past the "
-					"information about HFR and star count is unavailable",
+					"HFR and star count are measured by the plugin and may "
+					"differ from what KStars reports",
 					false, Gtk::MessageType::MESSAGE_WARNING, Gtk::ButtonsType::BUTTONS_YES_NO, true));
 		m_dialog->set_title("Bulk image upload");
 		m_dialog->set_secondary_text("Do you want to continue?");
@@ -575,11 +839,14 @@ void FrmMain::processBulk(std::vector<std::string> files) {
 		if ( m_shutdownBulk ) {
 			break;
 		}
-		FrameData frameData(files[ii], -1, 0, 0.0, NAN, NAN, NAN);
+		// Neither median nor stars are known, they are measured instead
+		FrameData frameData(files[ii], -1, -1, -1, NAN, NAN, NAN);
 		try {
 			snprintf(buff, sizeof(buff), "Processing file %s\n", frameData.m_fileName.c_str());
 			log(buff);
-			processFile(frameData);
+			processFile(Producer::BULK, frameData, [&files, ii, num] {
+					return FrameData(ii + 1 < num ? files[ii+1] : std::string(""), -1, -1, -1, NAN, NAN, NAN);
+					});
 			m_nSuccess.set(m_nSuccess.get()+1);
 		} catch ( const std::exception& e ) {
 			snprintf(buff, sizeof(buff), "Error processing file %s: %s\n",
@@ -592,6 +859,7 @@ void FrmMain::processBulk(std::vector<std::string> files) {
 			log(buff);
 			m_nFailure.set(m_nFailure.get()+1);
 		}
+		BufferPool::instance().trim();
 		updateBulkProgress((ii+1.) / num);
 	}
 	m_bulkFinishDispatcher();
@@ -636,13 +904,22 @@ void FrmMain::runBulkUpload() {
 	m_bulkFileChooserDialog->add_button("Select", Gtk::RESPONSE_OK);
 
 	Glib::RefPtr<Gtk::FileFilter> fileFilter = Gtk::FileFilter::create();
-	fileFilter->set_name("Fits Files (*.fits *.fit)");
+	fileFilter->set_name("Fits Files (*.fits *.fit *.fz *.fits.gz *.fit.gz)");
 	fileFilter->add_pattern("*.fits");
 	fileFilter->add_pattern("*.Fits");
 	fileFilter->add_pattern("*.FITS");
 	fileFilter->add_pattern("*.fit");
 	fileFilter->add_pattern("*.Fit");
 	fileFilter->add_pattern("*.FIT");
+	fileFilter->add_pattern("*.fz");
+	fileFilter->add_pattern("*.Fz");
+	fileFilter->add_pattern("*.FZ");
+	fileFilter->add_pattern("*.fits.gz");
+	fileFilter->add_pattern("*.Fits.gz");
+	fileFilter->add_pattern("*.FITS.GZ");
+	fileFilter->add_pattern("*.fit.gz");
+	fileFilter->add_pattern("*.Fit.gz");
+	fileFilter->add_pattern("*.FIT.GZ");
 	m_bulkFileChooserDialog->add_filter(fileFilter);
 
 	m_bulkFileChooserDialog->signal_response().connect([this](int response) {
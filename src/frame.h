@@ -12,6 +12,10 @@
 #include <fstream>
 #include <cstdio>
 #include <exception>
+#include <future>
+#include <functional>
+
+#include <fcntl.h>
 
 #include <unistd.h>
 
@@ -26,6 +30,8 @@
 #include "httplib.h"
 #include "common.h"
 #include "image.h"
+#include "filewatch.h"
+#include "bufferpool.h"
 #include "json.hpp"
 #include "Base64.h"
 
@@ -39,6 +45,27 @@ namespace ELB {
 	using namespace std::chrono_literals;
 
 	class FrmMain : public Gtk::ApplicationWindow {
+			enum class PrefetchMode {
+				NONE = 0,
+				CACHE = 1,
+				DECODE = 2,
+			};
+
+			// Live and bulk uploads may run at the same time, each of them
+			// prefetches its own next frame
+			enum class Producer {
+				LIVE = 0,
+				BULK = 1,
+			};
+
+			typedef std::future<std::unique_ptr<FFPtr>> PrefetchFuture;
+
+			class Prefetched {
+				public:
+					std::string m_fileName = "";
+					PrefetchFuture m_file;
+			};
+
 			class FrameData {
 				public:
 					FrameData(const Glib::ustring &fileName,
@@ -70,8 +97,13 @@ namespace ELB {
 					const Glib::VariantContainerBase& parameters
 					);
 			void log(const std::string &msg, bool showTimestamp = true);
-			void processFile(const FrameData &frameData);
+			void processFile(Producer producer, const FrameData &frameData,
+					std::function<FrameData()> nextFile = nullptr);
+			void prefetch(Producer producer, const FrameData &frameData);
+			std::unique_ptr<FFPtr> takePrefetched(Producer producer, const std::string &fileName);
+			void retirePrefetched(PrefetchFuture &future, std::vector<PrefetchFuture> &finished);
 			void processIfPresent();
+			void waitForFile(const FrameData &frameData);
 			void runWorker();
 			void stopWorker();
 			bool quit(_GdkEventAny* event);
@@ -86,6 +118,16 @@ namespace ELB {
                         void extractTargetData(Glib::VariantContainerBase &stuff, double &ra, double &dec, double &pa);
 
 			bool m_debug = false;
+			ImageOptions m_imageOptions;
+			std::chrono::milliseconds m_readyTimeout = 10s;
+			long m_nReadyWaits = 0;
+			std::chrono::milliseconds m_readyWaitTotal = 0ms;
+			std::chrono::milliseconds m_readyWaitMax = 0ms;
+			PrefetchMode m_prefetchMode = PrefetchMode::DECODE;
+			Prefetched m_prefetched[2];
+			// Prefetches nobody took, they are left to finish on their own
+			std::vector<PrefetchFuture> m_retired;
+			std::mutex m_prefetchMutex;
 
 			std::string m_kstarsName = "org.kde.kstars";
 			std::string m_capturePath = "/KStars/Ekos/Capture";
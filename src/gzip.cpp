@@ -0,0 +1,166 @@
+#include "gzip.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+namespace ELB {
+
+namespace {
+
+std::vector<uint8_t> readFile(const std::string &fname) {
+	std::ifstream stream(fname, std::ios::binary | std::ios::ate);
+	if ( ! stream.is_open() ) {
+		throw std::runtime_error("Could not open " + fname);
+	}
+	std::vector<uint8_t> data(stream.tellg());
+	stream.seekg(0);
+	if ( ! stream.read((char *) data.data(), data.size()) ) {
+		throw std::runtime_error("Could not read " + fname);
+	}
+	return data;
+}
+
+// The last four bytes hold the uncompressed size modulo 2^32, good enough
+// as a first guess for the output buffer
+size_t sizeHint(const std::vector<uint8_t> &data) {
+	size_t n = data.size();
+	return (size_t) data[n-4] | (size_t) data[n-3] << 8 | (size_t) data[n-2] << 16
+		| (size_t) data[n-1] << 24;
+}
+
+#ifdef HAVE_LIBDEFLATE
+bool inflateLibdeflate(const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+	struct libdeflate_decompressor *decompressor = libdeflate_alloc_decompressor();
+	if ( decompressor == NULL ) {
+		return false;
+	}
+	size_t actual = 0;
+	size_t consumed = 0;
+	auto result = libdeflate_gzip_decompress_ex(decompressor, in.data(), in.size(),
+			out.data(), out.size(), &consumed, &actual);
+	libdeflate_free_decompressor(decompressor);
+	// Multi member files or files above 4 GiB are left to zlib
+	if ( result != LIBDEFLATE_SUCCESS || consumed != in.size() ) {
+		return false;
+	}
+	out.resize(actual);
+	return true;
+}
+#endif
+
+void inflateZlib(const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+	z_stream stream = {};
+	// 32 enables gzip header detection
+	if ( inflateInit2(&stream, 15 + 32) != Z_OK ) {
+		throw std::runtime_error("Could not initialize zlib");
+	}
+	stream.next_in = (Bytef *) in.data();
+	stream.avail_in = in.size();
+	size_t produced = 0;
+	int ret = Z_OK;
+	while ( true ) {
+		if ( produced == out.size() ) {
+			out.resize(out.size() * 2 + (1<<20));
+		}
+		stream.next_out = out.data() + produced;
+		stream.avail_out = out.size() - produced;
+		ret = inflate(&stream, Z_NO_FLUSH);
+		produced = out.size() - stream.avail_out;
+		if ( ret == Z_STREAM_END ) {
+			if ( stream.avail_in == 0 ) {
+				break;
+			}
+			// Concatenated gzip members
+			inflateReset(&stream);
+			continue;
+		}
+		if ( ret != Z_OK && ret != Z_BUF_ERROR ) {
+			break;
+		}
+		if ( ret == Z_BUF_ERROR && stream.avail_in == 0 ) {
+			break;
+		}
+	}
+	inflateEnd(&stream);
+	if ( ret != Z_STREAM_END ) {
+		throw std::runtime_error("Corrupted gzip data");
+	}
+	out.resize(produced);
+}
+
+}
+
+bool isGzip(const std::string &fname) {
+	std::ifstream stream(fname, std::ios::binary);
+	unsigned char magic[2] = {0, 0};
+	stream.read((char *) magic, sizeof(magic));
+	return stream && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+std::vector<uint8_t> gunzip(const std::string &fname) {
+	std::vector<uint8_t> in = readFile(fname);
+	if ( in.size() < 18 ) {
+		throw std::runtime_error("Truncated gzip file " + fname);
+	}
+	std::vector<uint8_t> out(sizeHint(in));
+#ifdef HAVE_LIBDEFLATE
+	if ( inflateLibdeflate(in, out) ) {
+		return out;
+	}
+#endif
+	inflateZlib(in, out);
+	return out;
+}
+
+std::vector<uint8_t> gunzipHeader(const std::string &fname) {
+	const size_t blockSize = 2880, cardSize = 80;
+	gzFile file = gzopen(fname.c_str(), "rb");
+	if ( file == NULL ) {
+		throw std::runtime_error("Could not open " + fname);
+	}
+	std::vector<uint8_t> out;
+	long naxis = 0;
+	// Inflates one header. Optional ones may be missing at the end of the
+	// file, cfitsio complains about that later on.
+	auto readHeader = [&](bool optional) {
+		size_t start = out.size();
+		bool end = false;
+		while ( ! end ) {
+			size_t offset = out.size();
+			out.resize(offset + blockSize);
+			int nRead = gzread(file, out.data() + offset, blockSize);
+			if ( optional && nRead == 0 && offset == start ) {
+				out.resize(offset);
+				return;
+			}
+			if ( nRead != (int) blockSize ) {
+				gzclose(file);
+				throw std::runtime_error("Truncated FITS header in " + fname);
+			}
+			for ( size_t card=offset; card<out.size() && ! end; card+=cardSize ) {
+				std::string key((const char *) out.data() + card, 8);
+				end = key == "END     ";
+				if ( key == "NAXIS   " ) {
+					naxis = strtol((const char *) out.data() + card + 10, NULL, 10);
+				}
+			}
+		}
+	};
+	readHeader(false);
+	// An empty primary HDU has no data, fpack'ed files have the image in the
+	// extension that follows right away
+	if ( naxis == 0 ) {
+		readHeader(true);
+	}
+	gzclose(file);
+	return out;
+}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace ELB {
+
+	// Whether the file starts with the gzip magic bytes
+	bool isGzip(const std::string &fname);
+	// Inflates the complete file into memory in one go. Uses libdeflate when
+	// available and zlib otherwise.
+	std::vector<uint8_t> gunzip(const std::string &fname);
+	// Inflates only the primary FITS header, up to the end of the block that
+	// holds the END card. The header of the first extension is included when
+	// the primary HDU is empty.
+	std::vector<uint8_t> gunzipHeader(const std::string &fname);
+}
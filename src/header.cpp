@@ -0,0 +1,144 @@
+#include "header.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace ELB {
+
+void HeaderIndex::add(const char *card) {
+	size_t length = strnlen(card, 80);
+	if ( length < 10 || card[8] != '=' || card[9] != ' ' ) {
+		return;
+	}
+	std::string key(card, 8);
+	key.erase(key.find_last_not_of(' ') + 1);
+	std::string value(card + 10, length - 10);
+
+	// Cut off the comment, slashes within strings don't count
+	bool inString = false;
+	for ( size_t ii=0; ii<value.size(); ii++ ) {
+		if ( value[ii] == '\'' ) {
+			inString = ! inString;
+		} else if ( value[ii] == '/' && ! inString ) {
+			value.erase(ii);
+			break;
+		}
+	}
+	value.erase(0, value.find_first_not_of(' '));
+	value.erase(value.find_last_not_of(' ') + 1);
+	m_cards.emplace_back(key, value);
+}
+
+void HeaderIndex::finish() {
+	// Stable so the first occurrence of duplicate keywords wins, like in cfitsio
+	std::stable_sort(m_cards.begin(), m_cards.end(),
+			[](const std::pair<std::string, std::string> &a,
+				const std::pair<std::string, std::string> &b) {
+			return a.first < b.first;
+			});
+}
+
+size_t HeaderIndex::size() const {
+	return m_cards.size();
+}
+
+const std::string *HeaderIndex::find(const std::string &key) const {
+	auto it = std::lower_bound(m_cards.begin(), m_cards.end(), key,
+			[](const std::pair<std::string, std::string> &card, const std::string &key) {
+			return card.first < key;
+			});
+	if ( it == m_cards.end() || it->first != key ) {
+		return nullptr;
+	}
+	return &it->second;
+}
+
+bool HeaderIndex::has(const std::string &key) const {
+	return find(key) != nullptr;
+}
+
+bool HeaderIndex::get(const std::string &key, std::string &value) const {
+	const std::string *raw = find(key);
+	if ( raw == nullptr ) {
+		return false;
+	}
+	if ( raw->empty() || (*raw)[0] != '\'' ) {
+		// Not a string, hand out the value as written
+		value = *raw;
+		return true;
+	}
+	// Quotes within strings are doubled, trailing spaces are insignificant
+	value.clear();
+	for ( size_t ii=1; ii<raw->size(); ii++ ) {
+		if ( (*raw)[ii] == '\'' ) {
+			if ( ii + 1 < raw->size() && (*raw)[ii+1] == '\'' ) {
+				value += '\'';
+				ii++;
+				continue;
+			}
+			break;
+		}
+		value += (*raw)[ii];
+	}
+	value.erase(value.find_last_not_of(' ') + 1);
+	return true;
+}
+
+bool HeaderIndex::get(const std::string &key, double &value) const {
+	const std::string *raw = find(key);
+	if ( raw == nullptr || raw->empty() ) {
+		return false;
+	}
+	// Logicals count as 1 and 0 like in cfitsio
+	if ( *raw == "T" || *raw == "F" ) {
+		value = *raw == "T" ? 1 : 0;
+		return true;
+	}
+	// Numbers written as strings are converted as well, some writers quote
+	// RA, DEC and EXPTIME. Fortran style exponents are allowed in FITS.
+	std::string number;
+	get(key, number);
+	std::replace(number.begin(), number.end(), 'D', 'E');
+	std::replace(number.begin(), number.end(), 'd', 'e');
+	char *end = nullptr;
+	double result = strtod(number.c_str(), &end);
+	if ( end == number.c_str() || *end != '\0' ) {
+		return false;
+	}
+	value = result;
+	return true;
+}
+
+bool HeaderIndex::get(const std::string &key, long &value) const {
+	std::string number;
+	if ( ! get(key, number) || number.empty() ) {
+		return false;
+	}
+	char *end = nullptr;
+	long exact = strtol(number.c_str(), &end, 10);
+	if ( end != number.c_str() && *end == '\0' ) {
+		value = exact;
+		return true;
+	}
+	// Floating point values are truncated like cfitsio does
+	double result;
+	if ( ! get(key, result) || std::isnan(result) || result < LONG_MIN || result > LONG_MAX ) {
+		return false;
+	}
+	value = result;
+	return true;
+}
+
+bool HeaderIndex::get(const std::string &key, int &value) const {
+	long result;
+	if ( ! get(key, result) || result < INT_MIN || result > INT_MAX ) {
+		return false;
+	}
+	value = result;
+	return true;
+}
+
+}
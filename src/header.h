@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace ELB {
+
+	// All keywords of a FITS header, read once and kept as a sorted flat
+	// array. Lookups return false instead of throwing when a keyword is
+	// missing or its value can't be converted.
+	class HeaderIndex {
+		public:
+			// Adds an 80 character header card, cards without a value
+			// (COMMENT, HISTORY, ...) are ignored
+			void add(const char *card);
+			// Has to be called after the last card was added
+			void finish();
+			size_t size() const;
+			bool has(const std::string &key) const;
+			bool get(const std::string &key, std::string &value) const;
+			// Numbers are converted from quoted strings and logicals as well,
+			// like fits_read_key() does
+			bool get(const std::string &key, double &value) const;
+			bool get(const std::string &key, long &value) const;
+			bool get(const std::string &key, int &value) const;
+		private:
+			const std::string *find(const std::string &key) const;
+			// Keyword and the raw value field without the comment
+			std::vector<std::pair<std::string, std::string>> m_cards;
+	};
+}
@@ -2,6 +2,42 @@
 
 namespace ELB {
 
+namespace {
+
+// Pixel type, cfitsio type and OpenCV type every BITPIX is processed in.
+// There are no unsigned 32 bit matrices, float is plenty for a thumbnail.
+template <int BITPIX> struct PixelTraits;
+
+template <> struct PixelTraits<BYTE_IMG> {
+	typedef uchar type;
+	typedef uint64_t sumType;
+	static const int fitsType = TBYTE;
+	static const int cvType = CV_8U;
+};
+
+template <> struct PixelTraits<SHORT_IMG> {
+	typedef ushort type;
+	typedef uint64_t sumType;
+	static const int fitsType = TUSHORT;
+	static const int cvType = CV_16U;
+};
+
+template <> struct PixelTraits<LONG_IMG> {
+	typedef float type;
+	typedef double sumType;
+	static const int fitsType = TFLOAT;
+	static const int cvType = CV_32F;
+};
+
+template <> struct PixelTraits<FLOAT_IMG> {
+	typedef float type;
+	typedef double sumType;
+	static const int fitsType = TFLOAT;
+	static const int cvType = CV_32F;
+};
+
+}
+
 int FFPtr::bayerNameToValue(const std::string &name) {
 	static std::map<std::string, int> map = {
 		{ "RGGB", cv::COLOR_BayerRG2RGB },
@@ -35,109 +71,890 @@ void FFPtr::check(const std::string &message) {
     throw FitsError(message + ": " + fitsError() + " (" + m_fname + ")", m_status);
 }
 
-FFPtr::FFPtr(const std::string &fname) {
+FFPtr::FFPtr(const std::string &fname, const ImageOptions &options) {
     m_fname = fname;
-    fits_open_file(&m_ffptr, fname.c_str(), READONLY, &m_status);
-    check("Error opening file");
-
-	long fpix[2] = {1,1};
-	long lpix[2];
-	long inc[2] = {1,1};
-	int bitpix = 0;
-	pixfloat nullval = 0;
-	int anynull = 0;
+    m_options = options;
+    m_gzip = isGzip(fname);
+    if ( m_gzip ) {
+        // Frames may be rejected based on their header, so only that is
+        // inflated for now. loadPixels() inflates the rest.
+        m_memory = gunzipHeader(fname);
+        openMemory();
+    } else {
+        // Skips the empty primary HDU of fpack'ed files
+        fits_open_image(&m_ffptr, fname.c_str(), READONLY, &m_status);
+        check("Error opening file");
+    }
+    m_compressed = fits_is_compressed_image(m_ffptr, &m_status);
+    check("Error checking for compression");
 
-	// X and Y is swapped for FITS
-	read_key("NAXIS1", TLONG, &m_dimY, NULL);
-	read_key("NAXIS2", TLONG, &m_dimX, NULL);
-	lpix[0] = m_dimY;
-	lpix[1] = m_dimX;
+	// Read the complete header once, everything else is looked up in there
+	int nKeys = 0, moreKeys = 0;
+	get_hdrspace(&nKeys, &moreKeys);
+	for ( int ii=1; ii<=nKeys; ii++ ) {
+		char card[FLEN_CARD];
+		read_record(ii, card);
+		m_header.add(card);
+	}
+	m_header.finish();
+
+	// The keywords of compressed images describe the table holding the tiles,
+	// cfitsio knows about the actual image. X and Y is swapped for FITS.
+	int naxis = 0;
+	long naxes[2] = {0, 0};
+	get_img_param(2, &m_bitpix, &naxis, naxes);
+	m_dimY = naxes[0];
+	m_dimX = naxes[1];
 	m_nPix = m_dimX * m_dimY;
-	read_key("BITPIX", TINT, &bitpix, NULL);
-	auto rawData = std::make_unique<pixfloat[]>(m_nPix);
-	read_subset(fitsfloat, fpix, lpix, inc, &nullval, rawData.get(), &anynull);
-
-	m_initalMean = 0;
-    m_valueScale = 1. / (1<<bitpix) * (1<<16);
-	m_data = std::make_unique<cv::Mat>(m_dimX, m_dimY, CV_16U);
-	for ( long ii=0; ii<m_dimX; ii++) {
-		for ( long jj=0; jj<m_dimY; jj++) {
-			m_initalMean += rawData[ii*m_dimY + jj] / m_nPix;
-			m_data->at<ushort>(ii, jj) = rawData[ii*m_dimY + jj] * m_valueScale;
-		}
+	m_header.get("BAYERPAT", m_bayerPat);
+	m_header.get("BZERO", m_bzero);
+	m_header.get("BSCALE", m_bscale);
+	if ( m_options.decimate ) {
+		m_stride = decimationStride();
+	}
+}
+
+// Opens the inflated file in m_memory. Moves on to the first extension when
+// the primary HDU is empty, like fits_open_image() does for files on disk,
+// so fpack'ed files that were gzip'ed on top work as well.
+void FFPtr::openMemory() {
+	m_memPtr = m_memory.data();
+	m_memSize = m_memory.size();
+	fits_open_memfile(&m_ffptr, m_fname.c_str(), READONLY, &m_memPtr, &m_memSize,
+			0, NULL, &m_status);
+	check("Error opening file");
+	int naxis = 0;
+	fits_get_img_dim(m_ffptr, &naxis, &m_status);
+	check("Error reading image dimensions");
+	if ( naxis > 0 ) {
+		return;
+	}
+	int hduType = 0;
+	fits_movrel_hdu(m_ffptr, 1, &hduType, &m_status);
+	check("Error moving to the image extension");
+	if ( hduType != IMAGE_HDU && ! fits_is_compressed_image(m_ffptr, &m_status) ) {
+		m_status = NOT_IMAGE;
+	}
+	check("Error opening file");
+}
+
+// The pixel pipeline is expensive, only run it once somebody actually needs
+// the pixels so that frames which get rejected based on their header are cheap
+void FFPtr::decodeIfNecessary() {
+	if ( m_decoded ) {
+		return;
+	}
+
+	readGeometry();
+	// OpenCV can't debayer float data, which we could only normalize after
+	// having seen all of it, so those few frames can't be streamed. Neither
+	// can gzip'ed frames, they are inflated into memory as a whole.
+	m_overMemoryCap = m_options.memoryCap > 0 && estimatedMemory() > m_options.memoryCap;
+	m_streaming = m_overMemoryCap && ! m_gzip
+		&& ! ( ingestBitpix() == FLOAT_IMG && m_bayerPat != "" );
+	m_overMemoryCap = m_overMemoryCap && ! m_streaming;
+	auto start = std::chrono::steady_clock::now();
+	loadPixels();
+	switch ( ingestBitpix() ) {
+		case BYTE_IMG:
+			ingest<BYTE_IMG>();
+			break;
+		case SHORT_IMG:
+			ingest<SHORT_IMG>();
+			break;
+		case LONG_IMG:
+			ingest<LONG_IMG>();
+			break;
+		default:
+			ingest<FLOAT_IMG>();
+			break;
+	}
+	m_readTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	// The pixels are all in m_data now, don't hold the file a second time
+	// while the frame is encoded and uploaded. The cfitsio handle on inflated
+	// files is only closed from here on.
+	m_map.reset();
+	m_buffer.reset();
+	std::vector<uint8_t>().swap(m_memory);
+	m_dimX = m_data->rows;
+	m_dimY = m_data->cols;
+	m_nPix = m_dimX * m_dimY;
+
+	if ( m_detectStars ) {
+		findStars();
 	}
 	debayerIfNecessary();
+	if ( m_options.resampleFirst ) {
+		shrink();
+	}
 	stretch();
-	blur();
+	denoise();
 	resample();
+	m_decoded = true;
 }
 
-void FFPtr::debayerIfNecessary() {
+// Binning factor of the mono copy stars are detected in, so that it is at
+// most s_starWidth pixels wide. Bayer frames are binned by an even factor so
+// every binned pixel covers complete Bayer cells.
+long FFPtr::starFactor() const {
+	long factor = std::max((m_readCols + s_starWidth - 1) / s_starWidth, 1L);
+	if ( m_bayerPat != "" ) {
+		factor = (factor + 1) & ~1L;
+	}
+	return factor;
+}
+
+// Star detection runs on the raw pixels binned by starFactor(). Streamed
+// frames have their copy from reading, the working image is too small for
+// that. The HFR is given in pixels of the frame.
+void FFPtr::findStars() {
+	long factor = starFactor();
+	cv::Mat binned;
+	if ( m_streaming ) {
+		binned = m_starImage;
+		m_starImage.release();
+	} else {
+		cv::Mat source = (*m_data.get())(cv::Rect(0, 0, m_data->cols / factor * factor,
+					m_data->rows / factor * factor));
+		cv::resize(source, binned, cv::Size(source.cols / factor, source.rows / factor), 0., 0.,
+				cv::InterpolationFlags::INTER_AREA);
+		// In units of 16 bits of the full scale, whatever the data type
+		binned.convertTo(binned, CV_32F, (1<<16) * m_valueScale);
+	}
+	m_stars = detectStars(binned);
+	// Decimated Bayer frames are read in 2x2 cells, every pixel read stands
+	// for stride / cell pixels of the sensor
+	m_stars.hfr *= factor * m_stride / m_cell;
+	m_starsDetected = true;
+}
+
+// Gets plain uncompressed files into memory through the configured backend,
+// pixels of everything else are read by cfitsio
+void FFPtr::loadPixels() {
+	if ( m_gzip ) {
+		// Inflate in one go instead of letting cfitsio stream through zlib,
+		// cfitsio gets a new handle on the complete file
+		m_memory = gunzip(m_fname);
+		int status = 0;
+		fits_close_file(m_ffptr, &status);
+		m_ffptr = NULL;
+		openMemory();
+	}
+	if ( m_memory.size() > 0 ) {
+		m_map = FitsMap::view(m_memory.data(), m_memory.size());
+		m_ioBackend = "memory";
+	} else if ( m_options.ioBackend != "cfitsio" && ! m_compressed ) {
+		// The other backends read the whole file into memory, which would
+		// defeat streaming. Mapped pages are only page cache.
+		auto backend = IoBackend::create(m_streaming ? "mmap" : m_options.ioBackend);
+		auto start = std::chrono::steady_clock::now();
+		m_buffer = backend->read(m_fname);
+		if ( m_buffer ) {
+			m_map = FitsMap::view(m_buffer->data(), m_buffer->size());
+			m_ioBackend = backend->name();
+			if ( ! backend->lazy() ) {
+				m_ioBytes = m_buffer->size();
+				m_ioTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+	}
+	// Don't use the map if it disagrees with cfitsio in any way
+	if ( m_map && ( m_map->bitpix() != m_bitpix || m_map->naxis1() != m_dimY
+				|| m_map->naxis2() != m_dimX || m_map->bzero() != m_bzero
+				|| m_map->bscale() != m_bscale ) ) {
+		m_map.reset();
+	}
+	if ( ! m_map ) {
+		m_buffer.reset();
+		m_ioBackend = "cfitsio";
+		m_ioBytes = 0;
+		m_ioTime = 0;
+	}
+}
+
+// Reads the pixels in the narrowest type that holds them, straight into the
+// matrix. cfitsio applies BZERO/BSCALE for us. The statistics are gathered
+// band by band while the rows are still in the cache. Bands are read and
+// scanned by all cores unless they have to go through our one cfitsio
+// handle.
+template <int BITPIX>
+void FFPtr::ingest() {
+	typedef typename PixelTraits<BITPIX>::type T;
+	if ( m_streaming ) {
+		ingestStreaming<BITPIX>();
+		return;
+	}
+	m_data = std::make_unique<cv::Mat>(m_readRows, m_readCols, PixelTraits<BITPIX>::cvType);
+	initHistograms(PixelTraits<BITPIX>::cvType);
+	// Decompressing through several handles at once needs a reentrant
+	// cfitsio, otherwise the tiles are read one after the other
+	bool parallel = m_compressed && m_memory.size() == 0 && fits_is_reentrant();
+	if ( parallel ) {
+		readRowsParallel(PixelTraits<BITPIX>::fitsType, m_data->ptr<T>());
+	}
+	bool tiled = parallel || m_map;
+	TilePool &pool = TilePool::instance();
+	// Partial results of every worker
+	std::vector<double> sums(pool.workers(), 0);
+	std::vector<T> mins(pool.workers(), std::numeric_limits<T>::max());
+	std::vector<T> maxs(pool.workers(), std::numeric_limits<T>::lowest());
+	std::vector<std::vector<Histogram>> histograms(pool.workers(), m_histograms);
+	auto scan = [&](long band0, long band1, int worker) {
+		for ( long row=band0*s_readBand; row<std::min(band1*s_readBand, m_readRows); row+=s_readBand ) {
+			long nRows = std::min(s_readBand, m_readRows - row);
+			if ( ! parallel ) {
+				readRows(PixelTraits<BITPIX>::fitsType, row, nRows, m_data->ptr<T>(row));
+			}
+			for ( long ii=row; ii<row+nRows; ii++ ) {
+				typename PixelTraits<BITPIX>::sumType rowSum = 0;
+				sumMinMax(m_data->ptr<T>(ii), m_readCols, rowSum, mins[worker], maxs[worker]);
+				sums[worker] += rowSum;
+				countRow(m_data->ptr<T>(ii), ii, histograms[worker]);
+			}
+		}
+	};
+	long nBands = (m_readRows + s_readBand - 1) / s_readBand;
+	if ( tiled ) {
+		pool.run(nBands, 1, scan);
+	} else {
+		scan(0, nBands, 0);
+	}
+	double sum = 0;
+	T min = std::numeric_limits<T>::max(), max = std::numeric_limits<T>::lowest();
+	for ( int ww=0; ww<pool.workers(); ww++ ) {
+		sum += sums[ww];
+		min = std::min(min, mins[ww]);
+		max = std::max(max, maxs[ww]);
+		for ( size_t cc=0; cc<m_histograms.size(); cc++ ) {
+			m_histograms[cc].merge(histograms[ww][cc]);
+		}
+	}
+	m_initalMean = sum / (m_readRows * m_readCols);
+	finishScan(min, max);
+}
+
+// Processes the frame in bands of rows that fit into the memory cap. Every
+// band is read, debayered and area-downsampled to about twice the thumbnail
+// width right away, so only the small working image is kept for the rest
+// of the pipeline. A few rows at the bottom that don't fill a complete
+// downsampling cell are skipped.
+template <int BITPIX>
+void FFPtr::ingestStreaming() {
+	typedef typename PixelTraits<BITPIX>::type T;
+	bool bayer = m_bayerPat != "";
+	bool toShort = bayer && PixelTraits<BITPIX>::cvType == CV_32F;
+	int depth = toShort ? CV_16U : PixelTraits<BITPIX>::cvType;
+	int channels = bayer ? 3 : 1;
+
+	long factor = std::max(m_readCols / s_workingWidth, 1L);
+	long step = 2 * factor;
+	// Bands are binned for star detection as well, every band but the last
+	// has to cover complete cells of both
+	long starFactor = m_detectStars ? this->starFactor() : 1;
+	long unit = std::lcm(step, starFactor);
+	long rowBytes = m_readCols * (sizeof(T) + (toShort ? sizeof(ushort) : 0) + channels * sizeof(T));
+	long bandRows = std::max(m_options.memoryCap / rowBytes / unit, 1L) * unit;
+	long usedRows = m_readRows / step * step;
+
+	m_data = std::make_unique<cv::Mat>(usedRows / factor, m_readCols / factor, CV_MAKETYPE(depth, channels));
+	cv::Mat band(std::min(bandRows, usedRows), m_readCols, PixelTraits<BITPIX>::cvType);
+	cv::Mat converted, debayered;
+	initHistograms(PixelTraits<BITPIX>::cvType);
+	if ( m_histograms.empty() ) {
+		// The statistics can't come from the working image, it is binned
+		m_sample.create((usedRows + s_statsRowStep - 1) / s_statsRowStep,
+				(m_readCols + s_statsRowStep - 1) / s_statsRowStep, PixelTraits<BITPIX>::cvType);
+	}
+	if ( m_detectStars ) {
+		m_starImage.create(usedRows / starFactor, m_readCols / starFactor, CV_32F);
+	}
+	double sum = 0;
+	T min = std::numeric_limits<T>::max(), max = std::numeric_limits<T>::lowest();
+	for ( long row=0; row<usedRows; row+=bandRows ) {
+		long nRows = std::min(bandRows, usedRows - row);
+		cv::Mat in = band.rowRange(0, nRows);
+		readRows(PixelTraits<BITPIX>::fitsType, row, nRows, in.ptr<T>());
+		for ( long ii=0; ii<nRows; ii++ ) {
+			typename PixelTraits<BITPIX>::sumType rowSum = 0;
+			sumMinMax(in.ptr<T>(ii), m_readCols, rowSum, min, max);
+			sum += rowSum;
+			countRow(in.ptr<T>(ii), row + ii, m_histograms);
+			if ( ! m_sample.empty() && (row + ii) % s_statsRowStep == 0 ) {
+				const T *pixel = in.ptr<T>(ii);
+				T *sample = m_sample.ptr<T>((row + ii) / s_statsRowStep);
+				for ( long jj=0; jj<m_sample.cols; jj++ ) {
+					sample[jj] = pixel[jj * s_statsRowStep];
+				}
+			}
+		}
+		long starRows = nRows / starFactor;
+		if ( m_detectStars && starRows > 0 ) {
+			// Binned before debayering like in-memory frames are
+			cv::Mat stars;
+			cv::resize(in(cv::Rect(0, 0, m_starImage.cols * starFactor, starRows * starFactor)), stars,
+					cv::Size(m_starImage.cols, starRows), 0., 0., cv::InterpolationFlags::INTER_AREA);
+			cv::Mat out = m_starImage.rowRange(row / starFactor, row / starFactor + starRows);
+			stars.convertTo(out, CV_32F);
+		}
+		if ( bayer ) {
+			if ( toShort ) {
+				in.convertTo(converted, CV_16U, (1<<16) / fullScale(max));
+				in = converted;
+			}
+			if ( m_options.debayer == ImageOptions::Debayer::SUPERPIXEL && factor >= 2 ) {
+				superpixel(in, debayered);
+			} else {
+				cv::cvtColor(in, debayered, bayerNameToValue(m_bayerPat));
+			}
+			in = debayered;
+		}
+		cv::Mat out = m_data->rowRange(row / factor, (row + nRows) / factor);
+		cv::resize(in, out, out.size(), 0., 0., cv::InterpolationFlags::INTER_AREA);
+	}
+	m_initalMean = sum / (usedRows * m_readCols);
+	finishScan(min, max);
+	if ( m_detectStars ) {
+		// In units of 16 bits of the full scale, whatever the data type
+		m_starImage.convertTo(m_starImage, CV_32F, (1<<16) * m_valueScale);
+	}
+	if ( toShort ) {
+		m_valueScale = 1. / (1<<16);
+	}
+	m_workingFactor = factor;
+}
+
+// Integer data gets one histogram per color of the Bayer matrix, which is
+// what stretch() needs as long as the frame isn't resampled
+void FFPtr::initHistograms(int depth) {
+	m_histograms.clear();
+	if ( depth == CV_8U || depth == CV_16U ) {
+		m_histograms.assign(m_bayerPat == "" ? 1 : 3, Histogram(depth));
+	}
+}
+
+template <typename T>
+void FFPtr::countRow(const T *pixel, long row, std::vector<Histogram> &histograms) const {
+	if constexpr ( std::is_integral<T>::value ) {
+		if ( histograms.size() == 1 ) {
+			histograms[0].add(pixel, m_readCols);
+			return;
+		}
+		for ( long dx=0; dx<2 && dx<m_readCols; dx++ ) {
+			histograms[cfaChannel(row, dx)].add(pixel + dx, (m_readCols - dx + 1) / 2, 2);
+		}
+	}
+}
+
+void FFPtr::finishScan(double min, double max) {
+	m_initialMin = min;
+	m_initialMax = max;
+	m_valueScale = 1. / fullScale(max);
+	m_saturated = 0;
+	int bitpix = ingestBitpix();
+	if ( bitpix == BYTE_IMG || bitpix == SHORT_IMG ) {
+		// Pixels at the largest value the data type can hold
+		int top = bitpix == BYTE_IMG ? UINT8_MAX : UINT16_MAX;
+		for ( const auto &histogram : m_histograms ) {
+			m_saturated += histogram.bin(top);
+		}
+	}
+	gatherStatistics();
+}
+
+// Frame wide statistics of the raw pixels. Integer data has its histograms
+// from reading already, so this only adds them up. Float and 32 bit data can
+// have any range and less than one ADU of noise, so their median and MAD are
+// taken from a sample of the float values instead of a histogram.
+void FFPtr::gatherStatistics() {
+	m_statistics.mean = m_initalMean;
+	m_statistics.min = m_initialMin;
+	m_statistics.max = m_initialMax;
+	if ( m_histograms.size() > 0 ) {
+		Histogram histogram = m_histograms[0];
+		for ( size_t cc=1; cc<m_histograms.size(); cc++ ) {
+			histogram.merge(m_histograms[cc]);
+		}
+		int median = histogram.median();
+		m_statistics.median = median;
+		m_statistics.mad = histogram.medianDeviation(median);
+		m_statistics.saturated = histogram.count() > 0 ? (double) m_saturated / histogram.count() : 0;
+		m_statistics.noise = histogram.noise();
+	} else {
+		std::vector<float> values = sampledValues();
+		m_statistics.median = 0;
+		m_statistics.mad = 0;
+		if ( ! values.empty() ) {
+			auto middle = values.begin() + values.size() / 2;
+			std::nth_element(values.begin(), middle, values.end());
+			float median = *middle;
+			for ( auto &value : values ) {
+				value = std::fabs(value - median);
+			}
+			std::nth_element(values.begin(), middle, values.end());
+			m_statistics.median = median;
+			m_statistics.mad = *middle;
+		}
+		// Nothing is counted as saturated without a fixed top value
+		m_statistics.saturated = 0;
+		m_statistics.noise = noiseFromMad(m_statistics.mad);
+	}
+	m_sample.release();
+}
+
+// Every s_statsRowStep-th pixel of every s_statsRowStep-th row of the frame
+// as it is after reading, or the sample streamed frames took while reading,
+// as floats in ADU
+std::vector<float> FFPtr::sampledValues() const {
+	cv::Mat values = m_streaming ? m_sample : m_data->reshape(1);
+	long step = m_streaming ? 1 : s_statsRowStep;
+	long nRows = (values.rows + step - 1) / step;
+	long nCols = (values.cols + step - 1) / step;
+	std::vector<float> sample(nRows * nCols);
+	TilePool::instance().run(nRows, s_readBand, [&](long row0, long row1, int) {
+		cv::Mat row;
+		for ( long ii=row0; ii<row1; ii++ ) {
+			values.row(ii * step).convertTo(row, CV_32F);
+			const float *pixel = row.ptr<float>();
+			float *out = sample.data() + ii * nCols;
+			for ( long jj=0; jj<nCols; jj++ ) {
+				out[jj] = pixel[jj * step];
+			}
+		}
+	});
+	return sample;
+}
+
+// Index of the channel the pixel ends up in after debayering. OpenCV's
+// Bayer??2RGB codes for our patterns are its Bayer??2BGR codes of the
+// mirrored pattern, so the result is in BGR order like everything else.
+int FFPtr::cfaChannel(long row, long col) const {
+	switch ( m_bayerPat[(row % 2) * 2 + col % 2] ) {
+		case 'R':
+			return 2;
+		case 'G':
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Rough peak memory of the in-memory pipeline. Debayering holds the raw
+// frame and the debayered one, stretch() the debayered frame, its split
+// channels and their 8 bit output.
+long FFPtr::estimatedMemory() const {
+	long channels = m_bayerPat == "" ? 1 : 3;
+	// Everything but plain 8 and 16 bit data is read as float
+	long raw = sizeof(float);
+	if ( ingestBitpix() == BYTE_IMG || ingestBitpix() == SHORT_IMG ) {
+		raw = ingestBitpix() / 8;
+	}
+	// Float frames are debayered at 16 bit
+	long debayered = channels == 3 ? std::min(raw, (long) sizeof(uint16_t)) : raw;
+	long debayering = channels == 3 ? raw + channels * debayered : 0;
+	long stretching = 2 * channels * debayered + channels;
+	long memory = m_readRows * m_readCols * std::max(debayering, stretching);
+	if ( m_gzip ) {
+		// The inflated file is held until the pixels are ingested, decimated
+		// or not
+		memory += m_dimX * m_dimY * std::abs(m_bitpix) / 8;
+	}
+	return memory;
+}
+
+// BITPIX the pixels are processed as. Only plain unsigned 8 and 16 bit data
+// fits the unsigned types, signed or scaled data is read as float.
+int FFPtr::ingestBitpix() const {
+	if ( m_bitpix == BYTE_IMG ) {
+		// Signed bytes come with BZERO = -128
+		return m_bzero == 0 && m_bscale == 1 ? BYTE_IMG : FLOAT_IMG;
+	}
+	if ( m_bitpix == SHORT_IMG ) {
+		return m_bzero == 32768 && m_bscale == 1 ? SHORT_IMG : FLOAT_IMG;
+	}
+	return m_bitpix == LONG_IMG ? LONG_IMG : FLOAT_IMG;
+}
+
+// The value that is mapped to white before stretching. It depends on the
+// type the pixels are read as, not on the one in the file.
+double FFPtr::fullScale(double max) const {
+	int bitpix = ingestBitpix();
+	if ( bitpix > 0 ) {
+		return std::ldexp(1., bitpix);
+	}
+	// Floating point data is either normalized already or given in ADU
+	return max > 1 ? max : 1;
+}
+
+// Largest stride that still leaves about twice the thumbnail resolution for
+// resampling. Bayer frames need an even stride so the pattern survives.
+long FFPtr::decimationStride() const {
+	long stride = m_dimY / s_workingWidth;
+	if ( m_bayerPat != "" ) {
+		stride &= ~1L;
+	}
+	return std::max(stride, 1L);
+}
+
+// Size of the image as it is read, i.e. after decimation. Decimated Bayer
+// frames are read in complete 2x2 cells.
+void FFPtr::readGeometry() {
+	m_cell = (m_bayerPat != "" && m_stride > 1) ? 2 : 1;
+	m_readCols = ((m_dimY - m_cell) / m_stride + 1) * m_cell;
+	m_readRows = ((m_dimX - m_cell) / m_stride + 1) * m_cell;
+	m_readFraction = (double) (m_readRows * m_readCols) / (m_dimX * m_dimY);
+}
+
+// Reads nRows rows of the image as described by readGeometry() starting at
+// row0, both must be multiples of the cell size. For Bayer frames every
+// position within the cell is read as its own strided subset and the
+// subsets are interleaved again.
+template <typename T>
+void FFPtr::readRows(int datatype, long row0, long nRows, T *data, fitsfile *fptr) {
+	T nullval = 0;
+	long inc[2] = {m_stride, m_stride};
+	long nCols = m_readCols / m_cell;
+	long nCellRows = nRows / m_cell;
+	long cellRow0 = row0 / m_cell;
+
+	auto subset = m_cell == 1 ? nullptr : std::make_unique<T[]>(nCols * nCellRows);
+	for ( long dy=0; dy<m_cell; dy++ ) {
+		for ( long dx=0; dx<m_cell; dx++ ) {
+			long fpix[2] = {1 + dx, 1 + dy + cellRow0 * m_stride};
+			long lpix[2] = {fpix[0] + (nCols-1) * m_stride, fpix[1] + (nCellRows-1) * m_stride};
+			if ( m_cell == 1 ) {
+				readSubset(datatype, fpix, lpix, inc, &nullval, data, fptr);
+				continue;
+			}
+			readSubset(datatype, fpix, lpix, inc, &nullval, subset.get(), fptr);
+			for ( long ii=0; ii<nCellRows; ii++ ) {
+				for ( long jj=0; jj<nCols; jj++ ) {
+					data[(ii*m_cell + dy) * m_readCols + jj*m_cell + dx] = subset[ii*nCols + jj];
+				}
+			}
+		}
+	}
+}
+
+// Tile compressed images are decompressed band by band on the pool, every
+// worker reading through its own file handle
+template <typename T>
+void FFPtr::readRowsParallel(int datatype, T *data) {
+	TilePool &pool = TilePool::instance();
+	std::vector<fitsfile *> handles(pool.workers(), nullptr);
+	long nBands = (m_readRows + s_readBand - 1) / s_readBand;
+	auto closeAll = [&handles] {
+		for ( auto &fptr : handles ) {
+			if ( fptr != NULL ) {
+				int status = 0;
+				fits_close_file(fptr, &status);
+				fptr = NULL;
+			}
+		}
+	};
 	try {
-		char buff[32];
-		read_key("BAYERPAT", TSTRING, &buff, NULL);
-		m_bayerPat = buff;
-	} catch ( const FFPtr::FitsError &e ) {
-		resetStatus();
+		pool.run(nBands, 1, [&](long band0, long band1, int worker) {
+			fitsfile *&fptr = handles[worker];
+			if ( fptr == NULL ) {
+				int status = 0;
+				fits_open_image(&fptr, m_fname.c_str(), READONLY, &status);
+				if ( status != 0 ) {
+					fptr = NULL;
+					char text[STRBUFF];
+					fits_get_errstatus(status, text);
+					throw FitsError(std::string("Error opening file: ") + text + " (" + m_fname + ")", status);
+				}
+			}
+			long row0 = band0 * s_readBand;
+			long row1 = std::min(band1 * s_readBand, m_readRows);
+			readRows(datatype, row0, row1 - row0, data + row0 * m_readCols, fptr);
+		});
+	} catch ( ... ) {
+		closeAll();
+		throw;
+	}
+	closeAll();
+}
+
+// Pixel access goes through the memory map whenever the file allows it.
+// Reads through another handle than our own don't touch m_status.
+void FFPtr::readSubset(int datatype, long *fpix, long *lpix, long *inc,
+		void *nullval, void *data, fitsfile *fptr) {
+	if ( m_map ) {
+		m_map->read_subset(datatype, fpix, lpix, inc, data);
+		return;
+	}
+	int anynull = 0;
+	if ( fptr == NULL ) {
+		read_subset(datatype, fpix, lpix, inc, nullval, data, &anynull);
+		return;
+	}
+	int status = 0;
+	fits_read_subset(fptr, datatype, fpix, lpix, inc, nullval, data, &anynull, &status);
+	if ( status != 0 ) {
+		char text[STRBUFF];
+		fits_get_errstatus(status, text);
+		throw FitsError(std::string("Error reading pixel data: ") + text + " (" + m_fname + ")", status);
+	}
+}
+
+void FFPtr::debayerIfNecessary() {
+	if ( m_bayerPat == "" || m_data->channels() == 3 ) {
 		return;
 	}
 	int pattern = bayerNameToValue(m_bayerPat);
+	if ( m_data->depth() == CV_32F ) {
+		// OpenCV only debayers integer data
+		m_data->convertTo(*m_data.get(), CV_16U, (1<<16) * m_valueScale);
+		m_valueScale = 1. / (1<<16);
+	}
 	auto debayered = std::make_unique<cv::Mat>();
-	cv::cvtColor(*m_data.get(), *debayered, pattern);
+	if ( m_options.debayer == ImageOptions::Debayer::SUPERPIXEL ) {
+		superpixel(*m_data.get(), *debayered);
+		m_workingFactor *= 2;
+	} else {
+		cv::cvtColor(*m_data.get(), *debayered, pattern);
+	}
 	m_data = std::move(debayered);
+	m_dimX = m_data->rows;
+	m_dimY = m_data->cols;
+	m_nPix = m_dimX * m_dimY;
+}
+
+// One BGR pixel per 2x2 cell of the Bayer matrix with the two greens
+// averaged, half the resolution in both directions is plenty for the
+// thumbnail
+void FFPtr::superpixel(const cv::Mat &in, cv::Mat &out) const {
+	out.create(in.rows / 2, in.cols / 2, CV_MAKETYPE(in.depth(), 3));
+	if ( in.depth() == CV_8U ) {
+		superpixel<uchar>(in, out);
+	} else {
+		superpixel<ushort>(in, out);
+	}
+}
+
+template <typename T>
+void FFPtr::superpixel(const cv::Mat &in, cv::Mat &out) const {
+	// Position of every color within the cell
+	long red = 0, blue = 0, green[2] = {0, 0}, nGreen = 0;
+	for ( long pos=0; pos<4; pos++ ) {
+		switch ( cfaChannel(pos / 2, pos % 2) ) {
+			case 2:
+				red = pos;
+				break;
+			case 1:
+				green[nGreen++ % 2] = pos;
+				break;
+			default:
+				blue = pos;
+				break;
+		}
+	}
+	TilePool::instance().run(out.rows, s_readBand, [&](long row0, long row1, int) {
+		for ( long ii=row0; ii<row1; ii++ ) {
+			const T *rows[2] = {in.ptr<T>(2 * ii), in.ptr<T>(2 * ii + 1)};
+			T *pixel = out.ptr<T>(ii);
+			for ( long jj=0; jj<out.cols; jj++ ) {
+				pixel[3 * jj] = rows[blue / 2][2 * jj + blue % 2];
+				pixel[3 * jj + 1] = (rows[green[0] / 2][2 * jj + green[0] % 2]
+						+ rows[green[1] / 2][2 * jj + green[1] % 2] + 1) / 2;
+				pixel[3 * jj + 2] = rows[red / 2][2 * jj + red % 2];
+			}
+		}
+	});
+}
+
+// Area-downsamples to the working resolution before anything else touches
+// the pixels, so stretch() and denoise() only see a fraction of them. Averaging
+// cells of pixels takes out the noise the median blur would otherwise have
+// to remove at full resolution.
+void FFPtr::shrink() {
+	long factor = m_data->cols / s_workingWidth;
+	if ( factor < 2 ) {
+		return;
+	}
+	cv::resize(*m_data.get(), *m_data.get(), cv::Size(m_data->cols / factor, m_data->rows / factor),
+			0., 0., cv::InterpolationFlags::INTER_AREA);
+	m_dimX = m_data->rows;
+	m_dimY = m_data->cols;
+	m_nPix = m_dimX * m_dimY;
+	m_workingFactor *= factor;
 }
 
 // PixInsight MTF style autostretch
 void FFPtr::stretch() {
-	double targetBkg = 0.25;
-	double shadows_clip = -1.25;
 	std::vector<cv::Mat> channels;
 	cv::split(*m_data.get(), channels);
-	for ( auto &channel : channels ) {
-		channel.convertTo(channel, CV_32F, 1./(1<<16));
-		cv::Mat tmp = channel.clone();
-		std::vector<float> flat(tmp.begin<float>(), tmp.end<float>());
-		std::sort(flat.begin(), flat.end());
-		float median = flat[flat.size() / 2]; // Ignore the special median cause of flat.size() % 2 == 0
-		float avgdev = medianDeviation(flat, median);
-		float c0 = median + shadows_clip * avgdev;
-		float m = (targetBkg - 1) * (median - c0) / ((((2 * targetBkg) - 1) * (median - c0)) - targetBkg);
-		for ( long ii=0; ii<m_dimX; ii++ ) {
-			for ( long jj=0; jj<m_dimY; jj++ ) {
-				double val = channel.at<float>(ii,jj);
-				if ( val < c0 ) {
-					channel.at<float>(ii,jj) = 0;
-					continue;
-				}
-				if ( val == m ) {
-					channel.at<float>(ii,jj) = 0.5;
-					continue;
-				}
-				float out = (m - 1) * (val - c0)/(1 - c0) / ((((2 * m) - 1) * (val - c0)/(1 - c0)) - m);
-				channel.at<float>(ii,jj) = out;
+	// The histograms gathered while reading only fit data that wasn't resampled
+	bool raw = m_histograms.size() == channels.size() && m_workingFactor == 1;
+	// Everything else has to be counted, unless the last frame of the same
+	// sequence had the same background
+	std::string key = stretchKey();
+	// KStars already measured the median of mono frames, only the deviation
+	// is left to count and a sample does for that
+	bool known = channels.size() == 1 && ! std::isnan(m_knownMedian);
+	std::vector<StretchCache::Params> cached;
+	if ( raw || known || ! m_options.stretchCache
+			|| ! StretchCache::instance().get(key, cached) || cached.size() != channels.size() ) {
+		cached.clear();
+	}
+	std::vector<StretchCache::Params> params;
+	for ( size_t cc=0; cc<channels.size(); cc++ ) {
+		cv::Mat &channel = channels[cc];
+		double scale = m_valueScale;
+		if ( channel.depth() == CV_32F ) {
+			// 16 bit are plenty for the statistics of an 8 bit thumbnail
+			channel.convertTo(channel, CV_16U, (1<<16) * scale);
+			scale = 1. / (1<<16);
+		}
+		if ( cached.size() > 0 ) {
+			// Compared in ADU, the transfer function follows from the
+			// cached background at the scale of this frame
+			Histogram sample(channel, s_driftStep);
+			float drift = std::fabs(sample.median() * scale / m_valueScale - cached[cc].median);
+			if ( drift <= s_maxDrift * cached[cc].deviation ) {
+				params.push_back(mtfParams(cached[cc].median * m_valueScale,
+							cached[cc].deviation * m_valueScale));
 			}
 		}
-		channel.convertTo(channel, CV_16U, 1<<16);
+		if ( known ) {
+			double center = m_knownMedian * m_valueScale / scale;
+			if ( raw ) {
+				params.push_back(stretchParams(m_histograms[cc], scale, center));
+			} else {
+				params.push_back(stretchParams(Histogram(channel, s_driftStep), scale, center));
+			}
+		} else if ( params.size() == cc && raw ) {
+			params.push_back(stretchParams(m_histograms[cc], scale, m_histograms[cc].median()));
+		} else if ( params.size() == cc ) {
+			Histogram histogram(channel, m_options.statsStep);
+			params.push_back(stretchParams(histogram, scale, histogram.median()));
+		}
+		float c0 = params[cc].c0;
+		float m = params[cc].m;
+		// The input only has 2^8 or 2^16 distinct values, evaluate the
+		// transfer function once for each of them
+		std::vector<uchar> table = mtfTable(channel.depth() == CV_8U ? 1<<8 : 1<<16, scale, c0, m);
+		if ( channel.depth() == CV_8U ) {
+			cv::LUT(channel, cv::Mat(1, table.size(), CV_8U, table.data()), channel);
+			continue;
+		}
+		cv::Mat out(channel.rows, channel.cols, CV_8U);
+		TilePool::instance().run(channel.rows, s_readBand, [&](long row0, long row1, int) {
+			for ( long ii=row0; ii<row1; ii++ ) {
+				const ushort *in = channel.ptr<ushort>(ii);
+				uchar *pixel = out.ptr<uchar>(ii);
+				for ( long jj=0; jj<channel.cols; jj++ ) {
+					pixel[jj] = table[in[jj]];
+				}
+			}
+		});
+		channel = out;
 	}
 	cv::merge(channels, *m_data.get());
+	if ( m_options.stretchCache ) {
+		for ( auto &channel : params ) {
+			channel.median /= m_valueScale;
+			channel.deviation /= m_valueScale;
+		}
+		StretchCache::instance().put(key, params);
+	}
+}
+
+// Stretch parameters for a background at center, which is given in the units
+// of the histogram like the result
+StretchCache::Params FFPtr::stretchParams(const Histogram &histogram, double scale, double center) {
+	return mtfParams(center * scale, histogram.meanDeviation(center) * scale);
+}
+
+// Shadows clipping point and midtones balance for a background median and
+// mean deviation in [0, 1]
+StretchCache::Params FFPtr::mtfParams(float median, float avgdev) {
+	double targetBkg = 0.25;
+	double shadows_clip = -1.25;
+	float c0 = median + shadows_clip * avgdev;
+	float m = (targetBkg - 1) * (median - c0) / ((((2 * targetBkg) - 1) * (median - c0)) - targetBkg);
+	return {median, avgdev, c0, m};
+}
+
+// Frames with the same key belong to the same sequence
+std::string FFPtr::stretchKey() {
+	char buff[STRBUFF];
+	snprintf(buff, sizeof(buff), "%.3f|%d|", exposure(), gain());
+	return object() + "|" + filter() + "|" + buff;
 }
 
-void FFPtr::blur() {
-	m_data->convertTo(*m_data.get(), CV_8U, 1./(1<<8));
-	cv::medianBlur(*m_data.get(), *m_data.get(), 21);
+// 8 bit output of the midtones transfer function for every input value,
+// which is scaled to [0, 1] first
+std::vector<uchar> FFPtr::mtfTable(long nValues, double scale, float c0, float m) {
+	std::vector<uchar> table(nValues);
+	for ( long ii=0; ii<nValues; ii++ ) {
+		float val = ii * scale;
+		float out;
+		if ( val < c0 ) {
+			out = 0;
+		} else if ( val == m ) {
+			out = 0.5;
+		} else {
+			out = (m - 1) * (val - c0)/(1 - c0) / ((((2 * m) - 1) * (val - c0)/(1 - c0)) - m);
+		}
+		table[ii] = cv::saturate_cast<uchar>(out * (1<<8));
+	}
+	return table;
+}
+
+void FFPtr::denoise() {
+	switch ( m_options.denoise ) {
+		case ImageOptions::Denoise::NONE:
+			return;
+		case ImageOptions::Denoise::HOT_PIXELS:
+			removeHotPixels();
+			return;
+		case ImageOptions::Denoise::WORKING_MEDIAN:
+			shrink();
+			break;
+		case ImageOptions::Denoise::MEDIAN:
+			break;
+	}
+	// The kernel is meant for the full resolution, shrink it for decimated or
+	// downsampled frames. Decimated Bayer frames are read in 2x2 cells, every
+	// pixel read stands for stride / cell pixels of the sensor. OpenCV runs
+	// 8 bit medians of this size in constant time per pixel.
+	int kernel = (s_medianKernel / (m_stride / m_cell * m_workingFactor)) | 1;
+	if ( kernel < 3 ) {
+		return;
+	}
+	cv::medianBlur(*m_data.get(), *m_data.get(), kernel);
+}
+
+// Cosmetic correction only: pixels much brighter than the median of their
+// 3x3 neighbourhood are replaced by it, everything else is left alone
+void FFPtr::removeHotPixels() {
+	cv::Mat median, excess;
+	cv::medianBlur(*m_data.get(), median, 3);
+	cv::subtract(*m_data.get(), median, excess);
+	cv::Mat mask = excess > s_hotPixelExcess;
+	median.copyTo(*m_data.get(), mask);
 }
 
 void FFPtr::resample() {
-	long targetWidth = 300;
-	long targetHeight = m_dimX * targetWidth / m_dimY;
-	cv::resize(*m_data.get(), *m_data.get(), cv::Size(targetWidth, targetHeight),
-			0., 0., cv::InterpolationFlags::INTER_LANCZOS4);
+	long targetWidth = s_targetWidth;
+	long targetHeight = std::max(m_dimX * targetWidth / m_dimY, 1L);
+	Resampler::instance().resize(*m_data.get(), *m_data.get(), cv::Size(targetWidth, targetHeight));
 	m_dimX = targetWidth;
 	m_dimY = targetHeight;
 	m_nPix = m_dimX * m_dimY;
 }
 
+void FFPtr::setMedian(double median) {
+	m_knownMedian = median < 0 ? NAN : median;
+}
+
+void FFPtr::decode() {
+	decodeIfNecessary();
+}
+
 std::string FFPtr::encode() {
+	decodeIfNecessary();
 	std::vector<uchar> jpgBuffer;
 	// This returns a bool indicating whether the buffer can be decoded by
 	// opencv but we don't really care about that, so ignore it
@@ -146,268 +963,97 @@ std::string FFPtr::encode() {
 	return macaron::Base64::Encode(data);
 }
 
+const HeaderIndex &FFPtr::header() const {
+	return m_header;
+}
+
 int FFPtr::gain() {
-	if ( m_gain != nullptr ) {
-		return *m_gain;
-	}
 	int ret = -1;
-	try {
-		read_key("GAIN", TINT, &ret, NULL);
-	} catch ( const FitsError &e1 ) {
-		if ( e1.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		try {
-			read_key("ISOSPEED", TINT, &ret, NULL);
-		} catch ( const FitsError &e2 ) {
-			if ( e2.status() != KEY_NO_EXIST ) {
-				throw;
-			}
-			resetStatus();
-		}
+	if ( ! m_header.get("GAIN", ret) ) {
+		m_header.get("ISOSPEED", ret);
 	}
-	m_gain = std::make_unique<int>(ret);
 	return ret;
 }
 
 std::string FFPtr::object() {
-	if ( m_object != nullptr ) {
-		return *m_object;
-	}
 	std::string ret;
-	try {
-		char buff[STRBUFF];
-		read_key("OBJECT", TSTRING, buff, NULL);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		ret = std::string("");
-	}
-	m_object = std::make_unique<std::string>(ret);
+	m_header.get("OBJECT", ret);
 	return ret;
 }
 
 double FFPtr::rotation() {
-	if ( m_rotation != nullptr ) {
-		return *m_rotation;
-	}
 	double ret = NAN;
-	try {
-		read_key("CROTA1", TDOUBLE, &ret, NULL);
-	} catch ( FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_rotation = std::make_unique<double>(ret);
+	m_header.get("CROTA1", ret);
 	return ret;
 }
 
 std::string FFPtr::instrument() {
-	if ( m_instrument != nullptr ) {
-		return *m_instrument;
-	}
 	std::string ret;
-	try {
-		char buff[STRBUFF];
-		read_key("INSTRUME", TSTRING, buff, NULL);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		ret = std::string("");
-	}
-	m_instrument = std::make_unique<std::string>(ret);
+	m_header.get("INSTRUME", ret);
 	return ret;
 }
 
 std::string FFPtr::telescope() {
-	if ( m_telescope != nullptr ) {
-		return *m_telescope;
-	}
 	std::string ret;
-	try {
-		char buff[STRBUFF];
-		read_key("TELESCOP", TSTRING, buff, NULL);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		ret = std::string("");
-	}
-	m_telescope = std::make_unique<std::string>(ret);
+	m_header.get("TELESCOP", ret);
 	return ret;
 }
 
 double FFPtr::focalLength() {
-	if ( m_focalLength != nullptr ) {
-		return *m_focalLength;
-	}
 	double ret = NAN;
-	try {
-		read_key("FOCALLEN", TDOUBLE, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_focalLength = std::make_unique<double>(ret);
+	m_header.get("FOCALLEN", ret);
 	return ret;
 }
 
 double FFPtr::aperture() {
-	if ( m_aperture != nullptr ) {
-		return *m_aperture;
-	}
 	double ret = NAN;
-	try {
-		read_key("APTDIA", TDOUBLE, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_aperture = std::make_unique<double>(ret);
+	m_header.get("APTDIA", ret);
 	return ret;
 }
 
 double FFPtr::pixelSize() {
-	if ( m_pixelSize != nullptr ) {
-		return *m_pixelSize;
-	}
 	double ret = NAN;
-	try {
-		read_key("PIXSIZE1", TDOUBLE, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_pixelSize = std::make_unique<double>(ret);
+	m_header.get("PIXSIZE1", ret);
 	return ret;
 }
 
 double FFPtr::scale() {
-	if ( m_scale != nullptr ) {
-		return *m_scale;
-	}
 	double ret = NAN;
-	try {
-		read_key("SCALE", TDOUBLE, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_scale = std::make_unique<double>(ret);
+	m_header.get("SCALE", ret);
 	return ret;
 }
 
 std::string FFPtr::filter() {
-	if ( m_filter != nullptr ) {
-		return *m_filter;
-	}
 	std::string ret;
-	try {
-		char buff[STRBUFF];
-		read_key("FILTER", TSTRING, buff, NULL);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		ret = std::string("");
-	}
-	m_filter = std::make_unique<std::string>(ret);
+	m_header.get("FILTER", ret);
 	return ret;
 }
 
 double FFPtr::exposure() {
-	if ( m_exposure != nullptr ) {
-		return *m_exposure;
-	}
 	double ret = NAN;
-	try {
-		read_key("EXPTIME", TDOUBLE, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_exposure = std::make_unique<double>(ret);
+	m_header.get("EXPTIME", ret);
 	return ret;
 }
 
 int FFPtr::offset() {
-	if ( m_offset != nullptr ) {
-		return *m_offset;
-	}
 	int ret = -1;
-	try {
-		read_key("OFFSET", TINT, &ret, NULL);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-	}
-	m_offset = std::make_unique<int>(ret);
+	m_header.get("OFFSET", ret);
 	return ret;
 }
 
 std::string FFPtr::binning() {
-	if ( m_binning != nullptr ) {
-		return *m_binning;
+	int x, y;
+	if ( ! m_header.get("XBINNING", x) || ! m_header.get("YBINNING", y) ) {
+		return std::string("");
 	}
-	std::string ret;
-	try {
-		char buff[STRBUFF];
-		int x, y;
-		read_key("XBINNING", TINT, &x, NULL);
-		read_key("YBINNING", TINT, &y, NULL);
-		snprintf(buff, sizeof(buff), "%dx%d", x, y);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-		ret = std::string("");
-	}
-	m_binning = std::make_unique<std::string>(ret);
-	return ret;
+	char buff[STRBUFF];
+	snprintf(buff, sizeof(buff), "%dx%d", x, y);
+	return std::string(buff);
 }
 
 std::string FFPtr::time() {
-	if ( m_time != nullptr ) {
-		return *m_time;
-	}
 	std::string ret;
-	try {
-		char buff[STRBUFF];
-		read_key("DATE-OBS", TSTRING, buff, NULL);
-		ret = std::string(buff);
-	} catch ( const FitsError &e ) {
-		if ( e.status() != KEY_NO_EXIST ) {
-			throw;
-		}
-		resetStatus();
-
+	if ( ! m_header.get("DATE-OBS", ret) ) {
 		time_t rawTime;
 		struct tm *timeInfo;
 		timeInfo = localtime(&rawTime);
@@ -415,17 +1061,89 @@ std::string FFPtr::time() {
 		strftime(buff, sizeof(buff), "%H:%M:%S: ", timeInfo);
 		ret = std::string(buff);
 	}
-	m_time = std::make_unique<std::string>(ret);
 	return ret;
 }
 
+long FFPtr::stride() {
+	return m_stride;
+}
+
+double FFPtr::readFraction() {
+	decodeIfNecessary();
+	return m_readFraction;
+}
+
+bool FFPtr::overMemoryCap() {
+	decodeIfNecessary();
+	return m_overMemoryCap;
+}
+
+double FFPtr::readTime() {
+	decodeIfNecessary();
+	return m_readTime;
+}
+
+std::string FFPtr::ioBackend() {
+	decodeIfNecessary();
+	return m_ioBackend;
+}
+
+double FFPtr::ioThroughput() {
+	decodeIfNecessary();
+	return m_ioTime > 0 ? m_ioBytes / m_ioTime / 1e6 : 0;
+}
+
 double FFPtr::initialMean() {
+	decodeIfNecessary();
 	return m_initalMean;
 }
 
+double FFPtr::initialMin() {
+	decodeIfNecessary();
+	return m_initialMin;
+}
+
+double FFPtr::initialMax() {
+	decodeIfNecessary();
+	return m_initialMax;
+}
+
+long FFPtr::saturated() {
+	decodeIfNecessary();
+	return m_saturated;
+}
+
+void FFPtr::setDetectStars(bool detect) {
+	m_detectStars = detect;
+}
+
+long FFPtr::starCount() {
+	decodeIfNecessary();
+	return m_starsDetected ? m_stars.count : -1;
+}
+
+double FFPtr::hfr() {
+	decodeIfNecessary();
+	return m_starsDetected ? m_stars.hfr : NAN;
+}
+
+const FrameStatistics &FFPtr::statistics() {
+	decodeIfNecessary();
+	return m_statistics;
+}
+
+// Pixels are read after the constructor returned, so a failed read may have
+// left m_status set. Closing gets its own status and nothing is thrown from
+// here, a frame that failed to decode has been reported already.
 FFPtr::~FFPtr() {
-    fits_close_file(m_ffptr, &m_status);
-    check("Error closing file");
+	int status = 0;
+	fits_close_file(m_ffptr, &status);
+	if ( m_options.dropCache ) {
+		// The mapping has to go first, mapped pages aren't dropped
+		m_map.reset();
+		m_buffer.reset();
+		IoBackend::release(m_fname);
+	}
 }
 
 void FFPtr::read_key(const std::string &key, int datatype, void *value,
@@ -447,6 +1165,11 @@ void FFPtr::read_subset(int datatype, long *fpix, long *lpix, long *inc,
     check("Error reading pixel data");
 }
 
+void FFPtr::get_img_param(int maxdim, int *bitpix, int *naxis, long *naxes) {
+    fits_get_img_param(m_ffptr, maxdim, bitpix, naxis, naxes, &m_status);
+    check("Error reading image geometry");
+}
+
 void FFPtr::get_hdrspace(int *numKeys, int *moreKeys) {
     fits_get_hdrspace(m_ffptr, numKeys, moreKeys, &m_status);
     check("Error getting header size");
@@ -486,14 +1209,6 @@ void FFPtr::resetStatus() {
     m_status = 0;
 }
 
-float FFPtr::medianDeviation(const std::vector<float> &data, float median) {
-	double ret = 0;
-	for ( const auto &val : data ) {
-		ret += fabs(val - median);
-	}
-	return ret / data.size();
-}
-
 FFPtr::FitsError::FitsError(const std::string &message, int status) : std::runtime_error(message) {
 	m_status = status;
 	m_message = message;
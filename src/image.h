@@ -5,6 +5,13 @@
 #include <stdexcept>
 #include <memory>
 #include <map>
+#include <chrono>
+#include <vector>
+#include <exception>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+#include <numeric>
 
 #include <fitsio.h>
 
@@ -14,15 +21,49 @@
 #include <string>
 
 #include "Base64.h"
+#include "fitsmap.h"
+#include "header.h"
+#include "gzip.h"
+#include "iobackend.h"
+#include "simd.h"
+#include "pool.h"
+#include "resampler.h"
+#include "stars.h"
+#include "stats.h"
 
 #define STRBUFF (256)
 
-#define pixfloat float
-#define fitsfloat TFLOAT
-#define cvfloat CV_16U
-
 namespace ELB {
 
+	struct ImageOptions {
+		enum class Debayer { BILINEAR, SUPERPIXEL };
+		enum class Denoise { MEDIAN, WORKING_MEDIAN, HOT_PIXELS, NONE };
+
+		// Read only every n-th pixel, enough for the thumbnail
+		bool decimate = false;
+		// Stream frames whose processing would need more bytes than this
+		// in bands of rows, 0 disables streaming
+		long memoryCap = 0;
+		// How plain uncompressed files get into memory, see IoBackend.
+		// "cfitsio" leaves reading them to cfitsio.
+		std::string ioBackend = "mmap";
+		// Drop files from the page cache once they have been processed
+		bool dropCache = false;
+		// Downsample to the working resolution before stretching and
+		// denoising instead of only at the end
+		bool resampleFirst = false;
+		// Base the stretch statistics on every n-th pixel of every n-th row
+		long statsStep = 1;
+		// Superpixel debayering turns every Bayer cell into one RGB pixel
+		Debayer debayer = Debayer::BILINEAR;
+		// A median over the frame as it is, a median after downsampling to
+		// the working resolution or only a hot pixel filter
+		Denoise denoise = Denoise::MEDIAN;
+		// Reuse the stretch parameters of the previous frame of the same
+		// target, filter, exposure and gain while its background holds
+		bool stretchCache = true;
+	};
+
     class FFPtr {
         public:
 			class FitsError : public std::runtime_error {
@@ -36,7 +77,7 @@ namespace ELB {
 			};
 			static int bayerNameToValue(const std::string &name);
 
-            FFPtr(const std::string &fname);
+            FFPtr(const std::string &fname, const ImageOptions &options = ImageOptions());
             ~FFPtr();
             void read_key(const std::string &key, int datatype, void *value,
                     char *comment);
@@ -48,6 +89,7 @@ namespace ELB {
             void resetStatus();
             void read_subset(int datatype, long *fpix, long *lpix, long *inc,
                     void *nullval, void *data, int *anynull);
+            void get_img_param(int maxdim, int *bitpix, int *naxis, long *naxes);
             void get_hdrspace(int *numKeys, int *moreKeys);
             void read_record(int ii, char *buffer);
             void read_keyn(int ii, char *name, char *value, char *comment);
@@ -55,6 +97,16 @@ namespace ELB {
             void write_record(const char *card);
             void write_img(int datatype, LONGLONG firstelement,
                     LONGLONG nelements, void *data);
+			const HeaderIndex &header() const;
+			// Median of the pixels if it is known already, KStars sends it
+			// along with captured frames. Negative values mean unknown.
+			// Has to be set before the frame is decoded.
+			void setMedian(double median);
+			// Counts the stars and measures their HFR while decoding, for
+			// frames KStars didn't analyse
+			void setDetectStars(bool detect);
+			// Runs the pixel pipeline right away instead of on first use
+			void decode();
 			std::string encode();
 			int gain();
 			int offset();
@@ -71,37 +123,135 @@ namespace ELB {
 			std::string binning();
 			std::string time();
 			double initialMean();
+			double initialMin();
+			double initialMax();
+			// Number of pixels at the largest value of 8 and 16 bit data
+			long saturated();
+			// Mean, median, spread and noise of the raw pixels
+			const FrameStatistics &statistics();
+			// Number of stars and their median HFR in pixels, -1 and NAN
+			// unless star detection was asked for
+			long starCount();
+			double hfr();
+			long stride();
+			// Fraction of the pixels of the frame that were read
+			double readFraction();
+			double readTime();
+			// Whether the frame needed more than the memory cap but couldn't
+			// be streamed
+			bool overMemoryCap();
+			// How the pixels were read and how fast, in MB/s. Only backends
+			// that read the whole file up front have a throughput, it is 0
+			// for mapped files and cfitsio.
+			std::string ioBackend();
+			double ioThroughput();
         private:
+			static constexpr long s_targetWidth = 300;
+			// Width frames are reduced to early on, leaves enough for resampling
+			static constexpr long s_workingWidth = 2 * s_targetWidth;
+			void decodeIfNecessary();
+			static constexpr long s_readBand = 64;
+			// Rows and columns of float and 32 bit frames that go into the
+			// statistics
+			static constexpr long s_statsRowStep = 4;
+			// Width of the binned copy stars are detected in
+			static constexpr long s_starWidth = 2048;
+			// Median kernel for full resolution frames
+			static constexpr int s_medianKernel = 21;
+			// How much brighter than its neighbourhood a hot pixel is
+			static constexpr int s_hotPixelExcess = 48;
+			// Pixel and row step of the background check against cached stretch
+			// parameters, and how far the median may move in mean deviations
+			static constexpr long s_driftStep = 16;
+			static constexpr float s_maxDrift = 0.25;
+			template <int BITPIX>
+			void ingest();
+			template <int BITPIX>
+			void ingestStreaming();
+			long estimatedMemory() const;
+			int ingestBitpix() const;
+			double fullScale(double max) const;
+			void initHistograms(int depth);
+			template <typename T>
+			void countRow(const T *pixel, long row, std::vector<Histogram> &histograms) const;
+			void finishScan(double min, double max);
+			void gatherStatistics();
+			long starFactor() const;
+			void findStars();
+			std::vector<float> sampledValues() const;
+			int cfaChannel(long row, long col) const;
+			long decimationStride() const;
+			void readGeometry();
+			void openMemory();
+			void loadPixels();
+			template <typename T>
+			void readRows(int datatype, long row0, long nRows, T *data,
+					fitsfile *fptr = NULL);
+			template <typename T>
+			void readRowsParallel(int datatype, T *data);
+			void readSubset(int datatype, long *fpix, long *lpix, long *inc,
+					void *nullval, void *data, fitsfile *fptr);
 			void debayerIfNecessary();
+			void superpixel(const cv::Mat &in, cv::Mat &out) const;
+			template <typename T>
+			void superpixel(const cv::Mat &in, cv::Mat &out) const;
+			void shrink();
 			void stretch();
-			void blur();
+			static StretchCache::Params stretchParams(const Histogram &histogram, double scale, double center);
+			static StretchCache::Params mtfParams(float median, float avgdev);
+			std::string stretchKey();
+			static std::vector<uchar> mtfTable(long nValues, double scale, float c0, float m);
+			void denoise();
+			void removeHotPixels();
 			void resample();
             std::string fitsError();
             std::string m_fname;
             fitsfile *m_ffptr = NULL;
+            std::unique_ptr<IoBuffer> m_buffer = nullptr;
+            std::unique_ptr<FitsMap> m_map = nullptr;
+            // Inflated header of gzip'ed files, the complete content while the
+            // pixels are read. cfitsio and the map work on it.
+            std::vector<uint8_t> m_memory;
+            void *m_memPtr = nullptr;
+            size_t m_memSize = 0;
+            bool m_gzip = false;
+            bool m_compressed = false;
+            HeaderIndex m_header;
             int m_status = 0;
 			long m_dimX, m_dimY, m_nPix;
+			int m_bitpix = 0;
+			bool m_decoded = false;
+			ImageOptions m_options;
+			long m_stride = 1;
+			long m_cell = 1;
+			bool m_streaming = false;
+			bool m_overMemoryCap = false;
+			long m_workingFactor = 1;
+			long m_readRows = 0, m_readCols = 0;
+			double m_readFraction = 1;
+			double m_bzero = 0, m_bscale = 1;
+			double m_readTime = 0;
+			std::string m_ioBackend = "cfitsio";
+			size_t m_ioBytes = 0;
+			double m_ioTime = 0;
 			double m_valueScale;
 			double m_initalMean;
+			double m_initialMin = 0, m_initialMax = 0;
+			double m_knownMedian = NAN;
+			long m_saturated = 0;
+			FrameStatistics m_statistics;
+			// Raw pixels of streamed frames without histograms for the
+			// statistics, see s_statsRowStep
+			cv::Mat m_sample;
+			bool m_detectStars = false;
+			// Binned copy of the raw pixels of streamed frames, see
+			// findStars()
+			cv::Mat m_starImage;
+			bool m_starsDetected = false;
+			StarField m_stars;
+			// Raw values of every color, filled while reading integer data
+			std::vector<Histogram> m_histograms;
 			std::unique_ptr<cv::Mat> m_data;
 			std::string m_bayerPat = "";
-
-			// header keywords
-			std::unique_ptr<int> m_gain = nullptr;
-			std::unique_ptr<std::string> m_object = nullptr;
-			std::unique_ptr<double> m_rotation = nullptr;
-			std::unique_ptr<std::string> m_instrument = nullptr;
-			std::unique_ptr<std::string> m_telescope = nullptr;
-			std::unique_ptr<double> m_focalLength = nullptr;
-			std::unique_ptr<double> m_aperture = nullptr;
-			std::unique_ptr<double> m_pixelSize = nullptr;
-			std::unique_ptr<double> m_scale = nullptr;
-			std::unique_ptr<std::string> m_filter = nullptr;
-			std::unique_ptr<double> m_exposure = nullptr;
-			std::unique_ptr<int> m_offset = nullptr;
-			std::unique_ptr<std::string> m_binning = nullptr;
-			std::unique_ptr<std::string> m_time = nullptr;
-
-			static float medianDeviation(const std::vector<float> &data, float median);
     };
 }
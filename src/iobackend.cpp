@@ -0,0 +1,356 @@
+#include "iobackend.h"
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace ELB {
+
+namespace {
+
+// Alignment O_DIRECT needs for buffers, offsets and lengths on all common
+// file systems
+const size_t s_alignment = 4096;
+// Size of a single read request
+const size_t s_chunkSize = 8 * 1024 * 1024;
+
+class MappedBuffer : public IoBuffer {
+	public:
+		MappedBuffer(void *base, size_t size) {
+			m_data = (const uint8_t *) base;
+			m_size = size;
+		}
+		~MappedBuffer() {
+			munmap((void *) m_data, m_size);
+		}
+};
+
+// Page aligned buffer from the pool, frames of the same size reuse it
+class HeapBuffer : public IoBuffer {
+	public:
+		// The capacity is rounded up to the alignment so that the last
+		// O_DIRECT read fits as well
+		HeapBuffer(size_t size) {
+			m_capacity = (size + s_alignment - 1) / s_alignment * s_alignment;
+			m_memory = BufferPool::instance().acquire(m_capacity);
+			m_data = (const uint8_t *) m_memory;
+			m_size = size;
+		}
+		~HeapBuffer() {
+			BufferPool::instance().release(m_memory, m_capacity);
+		}
+		uint8_t *writable() {
+			return (uint8_t *) m_memory;
+		}
+	private:
+		void *m_memory = nullptr;
+		size_t m_capacity = 0;
+};
+
+// Opens the file and returns its size, -1 on failure
+int openFile(const std::string &fname, int flags, size_t &size) {
+	int fd = ::open(fname.c_str(), O_RDONLY | flags);
+	if ( fd < 0 ) {
+		return -1;
+	}
+	struct stat info;
+	if ( fstat(fd, &info) != 0 || info.st_size == 0 ) {
+		::close(fd);
+		return -1;
+	}
+	size = info.st_size;
+	return fd;
+}
+
+// Reads size bytes starting at offset, short reads are continued
+bool readFully(int fd, uint8_t *data, size_t size, off_t offset) {
+	size_t done = 0;
+	while ( done < size ) {
+		ssize_t got = pread(fd, data + done, size - done, offset + done);
+		if ( got < 0 && errno == EINTR ) {
+			continue;
+		}
+		if ( got <= 0 ) {
+			return false;
+		}
+		done += got;
+	}
+	return true;
+}
+
+class MmapBackend : public IoBackend {
+	public:
+		std::string name() const override {
+			return "mmap";
+		}
+		bool lazy() const override {
+			return true;
+		}
+		std::unique_ptr<IoBuffer> read(const std::string &fname) override {
+			size_t size = 0;
+			int fd = openFile(fname, 0, size);
+			if ( fd < 0 ) {
+				return nullptr;
+			}
+			void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if ( base == MAP_FAILED ) {
+				return nullptr;
+			}
+			madvise(base, size, MADV_SEQUENTIAL);
+			return std::make_unique<MappedBuffer>(base, size);
+		}
+};
+
+class BufferedBackend : public IoBackend {
+	public:
+		std::string name() const override {
+			return "buffered";
+		}
+		std::unique_ptr<IoBuffer> read(const std::string &fname) override {
+			size_t size = 0;
+			int fd = openFile(fname, 0, size);
+			if ( fd < 0 ) {
+				return nullptr;
+			}
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			auto buffer = std::make_unique<HeapBuffer>(size);
+			bool ok = true;
+			for ( size_t offset=0; ok && offset<size; offset+=s_chunkSize ) {
+				ok = readFully(fd, buffer->writable() + offset,
+						std::min(s_chunkSize, size - offset), offset);
+			}
+			::close(fd);
+			return ok ? std::move(buffer) : nullptr;
+		}
+};
+
+// Frames are read exactly once, so there is no point in keeping them in the
+// page cache. File systems without O_DIRECT support are read buffered.
+class DirectBackend : public BufferedBackend {
+	public:
+		std::string name() const override {
+			return "direct";
+		}
+		std::unique_ptr<IoBuffer> read(const std::string &fname) override {
+			size_t size = 0;
+			int fd = openFile(fname, O_DIRECT, size);
+			if ( fd < 0 ) {
+				return BufferedBackend::read(fname);
+			}
+			auto buffer = std::make_unique<HeapBuffer>(size);
+			// Lengths have to be aligned as well, the last read comes back short
+			size_t aligned = (size + s_alignment - 1) / s_alignment * s_alignment;
+			for ( size_t offset=0; offset<size; offset+=s_chunkSize ) {
+				size_t length = std::min(s_chunkSize, aligned - offset);
+				ssize_t got;
+				do {
+					got = pread(fd, buffer->writable() + offset, length, offset);
+				} while ( got < 0 && errno == EINTR );
+				if ( got < 0 ) {
+					::close(fd);
+					return BufferedBackend::read(fname);
+				}
+				if ( (size_t) got < length && offset + got < size ) {
+					// Unaligned remainder, finish without O_DIRECT
+					::close(fd);
+					fd = openFile(fname, 0, size);
+					bool ok = fd >= 0 && readFully(fd, buffer->writable() + offset + got,
+							size - offset - got, offset + got);
+					if ( fd >= 0 ) {
+						::close(fd);
+					}
+					return ok ? std::move(buffer) : nullptr;
+				}
+			}
+			::close(fd);
+			return buffer;
+		}
+};
+
+#ifdef HAVE_LIBURING
+// Number of chunks kept in flight
+const unsigned s_queueDepth = 8;
+
+// Setting up a ring costs a few system calls and locked memory, so every
+// thread keeps one for all the frames it reads
+struct Ring {
+	Ring() {
+		ok = io_uring_queue_init(s_queueDepth, &ring, 0) == 0;
+	}
+	~Ring() {
+		if ( ok ) {
+			io_uring_queue_exit(&ring);
+		}
+	}
+	// For rings left with requests nobody will reap
+	void reset() {
+		if ( ok ) {
+			io_uring_queue_exit(&ring);
+		}
+		ok = io_uring_queue_init(s_queueDepth, &ring, 0) == 0;
+	}
+	struct io_uring ring;
+	bool ok = false;
+};
+
+Ring &threadRing() {
+	static thread_local Ring ring;
+	return ring;
+}
+
+// Keeps s_queueDepth chunks in flight so the device always has work queued,
+// which matters for NVMe drives and network file systems. Kernels without
+// io_uring get the file read buffered.
+class UringBackend : public BufferedBackend {
+	public:
+		std::string name() const override {
+			return threadRing().ok ? "uring" : "buffered";
+		}
+		std::unique_ptr<IoBuffer> read(const std::string &fname) override {
+			Ring &ring = threadRing();
+			if ( ! ring.ok ) {
+				return BufferedBackend::read(fname);
+			}
+			size_t size = 0;
+			int fd = openFile(fname, 0, size);
+			if ( fd < 0 ) {
+				return nullptr;
+			}
+			auto buffer = std::make_unique<HeapBuffer>(size);
+			size_t nChunks = (size + s_chunkSize - 1) / s_chunkSize;
+			// Chunks prepared but not submitted yet, and submitted ones
+			size_t next = 0, done = 0, queued = 0, inFlight = 0;
+			bool ok = true;
+			while ( ok && done < nChunks ) {
+				while ( queued + inFlight < s_queueDepth && next < nChunks ) {
+					struct io_uring_sqe *sqe = io_uring_get_sqe(&ring.ring);
+					if ( sqe == NULL ) {
+						break;
+					}
+					size_t offset = next * s_chunkSize;
+					io_uring_prep_read(sqe, fd, buffer->writable() + offset,
+							std::min(s_chunkSize, size - offset), offset);
+					io_uring_sqe_set_data(sqe, (void *) next);
+					next++;
+					queued++;
+				}
+				if ( queued > 0 ) {
+					int submitted = io_uring_submit(&ring.ring);
+					if ( submitted < 0 ) {
+						ok = false;
+						break;
+					}
+					queued -= submitted;
+					inFlight += submitted;
+				}
+				if ( inFlight == 0 ) {
+					// Nothing could be queued, waiting would hang
+					ok = false;
+					break;
+				}
+				struct io_uring_cqe *cqe = NULL;
+				int ret = io_uring_wait_cqe(&ring.ring, &cqe);
+				if ( ret == -EINTR ) {
+					continue;
+				}
+				if ( ret != 0 ) {
+					ok = false;
+					break;
+				}
+				size_t chunk = (size_t) io_uring_cqe_get_data(cqe);
+				int got = cqe->res;
+				io_uring_cqe_seen(&ring.ring, cqe);
+				inFlight--;
+				done++;
+				size_t offset = chunk * s_chunkSize;
+				size_t length = std::min(s_chunkSize, size - offset);
+				if ( got < 0 ) {
+					ok = false;
+				} else if ( (size_t) got < length ) {
+					ok = readFully(fd, buffer->writable() + offset + got,
+							length - got, offset + got);
+				}
+			}
+			// Reap whatever is still in flight before the buffer goes away
+			while ( inFlight > 0 ) {
+				struct io_uring_cqe *cqe = NULL;
+				int ret = io_uring_wait_cqe(&ring.ring, &cqe);
+				if ( ret == -EINTR ) {
+					continue;
+				}
+				if ( ret != 0 ) {
+					break;
+				}
+				io_uring_cqe_seen(&ring.ring, cqe);
+				inFlight--;
+			}
+			::close(fd);
+			if ( inFlight > 0 ) {
+				// The kernel may still write into the buffer, it can't be
+				// handed back to the pool
+				buffer.release();
+			}
+			if ( queued > 0 || inFlight > 0 ) {
+				ring.reset();
+			}
+			return ok ? std::move(buffer) : nullptr;
+		}
+};
+#endif
+
+}
+
+const uint8_t *IoBuffer::data() const {
+	return m_data;
+}
+
+size_t IoBuffer::size() const {
+	return m_size;
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(const std::string &name) {
+	if ( name == "mmap" ) {
+		return std::make_unique<MmapBackend>();
+	}
+	if ( name == "buffered" ) {
+		return std::make_unique<BufferedBackend>();
+	}
+	if ( name == "direct" ) {
+		return std::make_unique<DirectBackend>();
+	}
+	if ( name == "uring" ) {
+#ifdef HAVE_LIBURING
+		return std::make_unique<UringBackend>();
+#else
+		return std::make_unique<BufferedBackend>();
+#endif
+	}
+	throw std::runtime_error("Unknown I/O backend: " + name);
+}
+
+void IoBackend::release(const std::string &fname) {
+	int fd = ::open(fname.c_str(), O_RDONLY);
+	if ( fd < 0 ) {
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+}
+
+bool IoBackend::lazy() const {
+	return false;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace ELB {
+
+	// Complete content of a file, either mapped or read into memory
+	class IoBuffer {
+		public:
+			virtual ~IoBuffer() = default;
+			const uint8_t *data() const;
+			size_t size() const;
+		protected:
+			const uint8_t *m_data = nullptr;
+			size_t m_size = 0;
+	};
+
+	// How the pixel data of plain FITS files gets from the disk into memory.
+	// "mmap" faults pages in lazily as the pixels are read, "buffered" reads
+	// the file with plain read() calls, "direct" bypasses the page cache with
+	// O_DIRECT and "uring" keeps several large reads in flight with io_uring.
+	class IoBackend {
+		public:
+			// Throws for unknown names. Backends that aren't available in
+			// this build or on this file system fall back to "buffered".
+			static std::unique_ptr<IoBackend> create(const std::string &name);
+			// Tells the kernel the file won't be needed again so that it
+			// doesn't push out pages that are still useful
+			static void release(const std::string &fname);
+			virtual ~IoBackend() = default;
+			virtual std::string name() const = 0;
+			// Whether read() only maps the file and the actual I/O happens
+			// while the pixels are accessed
+			virtual bool lazy() const;
+			// Returns nullptr if the file can't be read
+			virtual std::unique_ptr<IoBuffer> read(const std::string &fname) = 0;
+	};
+}
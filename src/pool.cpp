@@ -0,0 +1,101 @@
+#include "pool.h"
+
+#include <algorithm>
+
+namespace ELB {
+
+TilePool &TilePool::instance() {
+	static TilePool pool;
+	return pool;
+}
+
+TilePool::TilePool() {
+	int nThreads = std::max((int) std::thread::hardware_concurrency(), 1);
+	// The thread calling run() is a worker as well
+	for ( int ii=1; ii<nThreads; ii++ ) {
+		m_threads.emplace_back(&TilePool::work, this, ii);
+	}
+}
+
+TilePool::~TilePool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for ( auto &thread : m_threads ) {
+		thread.join();
+	}
+}
+
+int TilePool::workers() const {
+	return m_threads.size() + 1;
+}
+
+void TilePool::run(long n, long grain, const std::function<void(long, long, int)> &fn) {
+	grain = std::max(grain, 1L);
+	std::unique_lock<std::mutex> runLock(m_runMutex, std::try_to_lock);
+	if ( ! runLock.owns_lock() || m_threads.empty() || n <= grain ) {
+		if ( n > 0 ) {
+			fn(0, n, 0);
+		}
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fn = &fn;
+		m_n = n;
+		m_grain = grain;
+		m_next = 0;
+		m_error = nullptr;
+		m_active = m_threads.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+	process(0);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_active == 0; });
+	m_fn = nullptr;
+	if ( m_error ) {
+		std::rethrow_exception(m_error);
+	}
+}
+
+void TilePool::work(int worker) {
+	unsigned long seen = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while ( true ) {
+		m_wake.wait(lock, [this, seen] { return m_quit || m_generation != seen; });
+		if ( m_quit ) {
+			return;
+		}
+		seen = m_generation;
+		lock.unlock();
+		process(worker);
+		lock.lock();
+		if ( --m_active == 0 ) {
+			m_done.notify_all();
+		}
+	}
+}
+
+void TilePool::process(int worker) {
+	while ( true ) {
+		long begin = m_next.fetch_add(m_grain);
+		if ( begin >= m_n ) {
+			return;
+		}
+		try {
+			(*m_fn)(begin, std::min(begin + m_grain, m_n), worker);
+		} catch ( ... ) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if ( ! m_error ) {
+				m_error = std::current_exception();
+			}
+			// Nobody starts another chunk
+			m_next = m_n;
+		}
+	}
+}
+
+}
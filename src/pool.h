@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ELB {
+
+	// One worker per core that per-pixel stages hand their rows to. Work is
+	// split into chunks which the workers, and the calling thread, take from
+	// a shared counter until none are left, so slow chunks don't hold up the
+	// others.
+	class TilePool {
+		public:
+			static TilePool &instance();
+			~TilePool();
+			TilePool(const TilePool &other) = delete;
+			TilePool& operator=(const TilePool &other) = delete;
+
+			// Number of distinct worker indices run() hands out
+			int workers() const;
+			// Calls fn(begin, end, worker) for chunks of grain items covering
+			// [0, n) and returns once all of them are done. worker lies in
+			// [0, workers()) and is never used by two chunks at the same time,
+			// so it can index per worker partial results. Only one job runs at
+			// a time, others, including nested ones, run on the calling thread.
+			// The first exception thrown by fn is rethrown.
+			void run(long n, long grain, const std::function<void(long, long, int)> &fn);
+		private:
+			TilePool();
+			void work(int worker);
+			void process(int worker);
+
+			std::vector<std::thread> m_threads;
+			std::mutex m_runMutex;
+			std::mutex m_mutex;
+			std::condition_variable m_wake, m_done;
+			const std::function<void(long, long, int)> *m_fn = nullptr;
+			long m_n = 0, m_grain = 1;
+			std::atomic<long> m_next{0};
+			int m_active = 0;
+			unsigned long m_generation = 0;
+			bool m_quit = false;
+			std::exception_ptr m_error;
+	};
+}
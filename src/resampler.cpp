@@ -0,0 +1,125 @@
+#include "resampler.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+namespace ELB {
+
+namespace {
+
+double lanczos(double x, int lobes) {
+	x = std::fabs(x);
+	if ( x < 1e-9 ) {
+		return 1;
+	}
+	if ( x >= lobes ) {
+		return 0;
+	}
+	double px = M_PI * x;
+	return lobes * std::sin(px) * std::sin(px / lobes) / (px * px);
+}
+
+}
+
+Resampler &Resampler::instance() {
+	static Resampler resampler;
+	return resampler;
+}
+
+std::shared_ptr<const Resampler::Taps> Resampler::taps(int inSize, int outSize) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto &taps = m_cache[std::make_pair(inSize, outSize)];
+	if ( ! taps ) {
+		taps = computeTaps(inSize, outSize);
+	}
+	return taps;
+}
+
+std::shared_ptr<const Resampler::Taps> Resampler::computeTaps(int inSize, int outSize) {
+	auto taps = std::make_shared<Taps>();
+	double scale = (double) inSize / outSize;
+	double support = s_lobes * std::max(scale, 1.);
+	taps->count = 2 * (int) std::ceil(support) + 1;
+	taps->index.resize((size_t) outSize * taps->count);
+	taps->weight.resize((size_t) outSize * taps->count);
+	for ( int ii=0; ii<outSize; ii++ ) {
+		double center = (ii + 0.5) * scale - 0.5;
+		int first = (int) std::floor(center) - taps->count / 2;
+		double total = 0;
+		for ( int kk=0; kk<taps->count; kk++ ) {
+			int source = first + kk;
+			double weight = lanczos((source - center) / std::max(scale, 1.), s_lobes);
+			// Pixels beyond the edges are replaced by the edge pixel
+			taps->index[ii * taps->count + kk] = std::min(std::max(source, 0), inSize - 1);
+			taps->weight[ii * taps->count + kk] = weight;
+			total += weight;
+		}
+		for ( int kk=0; kk<taps->count; kk++ ) {
+			taps->weight[ii * taps->count + kk] /= total;
+		}
+	}
+	return taps;
+}
+
+void Resampler::resize(const cv::Mat &in, cv::Mat &out, cv::Size size) {
+	if ( in.depth() != CV_8U ) {
+		throw std::runtime_error("The thumbnail resampler only handles 8 bit images");
+	}
+	cv::Mat source = in;
+	long factor = std::min(in.cols / size.width, in.rows / size.height) / 2;
+	if ( factor >= 2 ) {
+		cv::resize(in, source, cv::Size(in.cols / factor, in.rows / factor), 0., 0.,
+				cv::InterpolationFlags::INTER_AREA);
+	}
+	int channels = source.channels();
+	auto horizontal = taps(source.cols, size.width);
+	auto vertical = taps(source.rows, size.height);
+
+	// Rows first into a float buffer, then columns straight into the output
+	cv::Mat rows(source.rows, size.width, CV_MAKETYPE(CV_32F, channels));
+	TilePool &pool = TilePool::instance();
+	pool.run(source.rows, 16, [&](long row0, long row1, int) {
+		for ( long yy=row0; yy<row1; yy++ ) {
+			const uchar *src = source.ptr<uchar>(yy);
+			float *dst = rows.ptr<float>(yy);
+			for ( int xx=0; xx<size.width; xx++ ) {
+				const int *index = &horizontal->index[xx * horizontal->count];
+				const float *weight = &horizontal->weight[xx * horizontal->count];
+				for ( int cc=0; cc<channels; cc++ ) {
+					float sum = 0;
+					for ( int kk=0; kk<horizontal->count; kk++ ) {
+						sum += weight[kk] * src[index[kk] * channels + cc];
+					}
+					dst[xx * channels + cc] = sum;
+				}
+			}
+		}
+	});
+	cv::Mat result(size, CV_MAKETYPE(CV_8U, channels));
+	long rowLength = (long) size.width * channels;
+	pool.run(size.height, 16, [&](long row0, long row1, int) {
+		std::vector<float> sum(rowLength);
+		for ( long yy=row0; yy<row1; yy++ ) {
+			const int *index = &vertical->index[yy * vertical->count];
+			const float *weight = &vertical->weight[yy * vertical->count];
+			std::fill(sum.begin(), sum.end(), 0.f);
+			for ( int kk=0; kk<vertical->count; kk++ ) {
+				const float *src = rows.ptr<float>(index[kk]);
+				for ( long xx=0; xx<rowLength; xx++ ) {
+					sum[xx] += weight[kk] * src[xx];
+				}
+			}
+			uchar *dst = result.ptr<uchar>(yy);
+			for ( long xx=0; xx<rowLength; xx++ ) {
+				dst[xx] = cv::saturate_cast<uchar>(sum[xx]);
+			}
+		}
+	});
+	out = result;
+}
+
+}
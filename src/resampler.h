@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace ELB {
+
+	// Separable Lanczos-3 reduction of 8 bit images to thumbnail size. The
+	// kernel is widened by the reduction factor so nothing aliases. Large
+	// reductions are done by integer area averaging first, which leaves at
+	// most a factor of four for the filter. The filter taps only depend on
+	// the sizes, which are the same for every frame of a camera, so they are
+	// computed once and kept.
+	class Resampler {
+		public:
+			static Resampler &instance();
+			Resampler(const Resampler &other) = delete;
+			Resampler& operator=(const Resampler &other) = delete;
+
+			void resize(const cv::Mat &in, cv::Mat &out, cv::Size size);
+		private:
+			static constexpr int s_lobes = 3;
+			// Source pixels and weights for every output pixel of one axis
+			struct Taps {
+				int count;
+				std::vector<int> index;
+				std::vector<float> weight;
+			};
+
+			Resampler() = default;
+			std::shared_ptr<const Taps> taps(int inSize, int outSize);
+			static std::shared_ptr<const Taps> computeTaps(int inSize, int outSize);
+
+			std::mutex m_mutex;
+			std::map<std::pair<int, int>, std::shared_ptr<const Taps>> m_cache;
+	};
+}
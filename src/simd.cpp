@@ -0,0 +1,429 @@
+#include "simd.h"
+
+#include <algorithm>
+#include <map>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace ELB {
+
+namespace {
+
+SimdLevel detectLevel() {
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports("avx2") ) {
+		return SimdLevel::AVX2;
+	}
+	// Part of the x86-64 baseline
+	return SimdLevel::SSE2;
+#elif defined(__aarch64__)
+	return SimdLevel::NEON;
+#else
+	return SimdLevel::SCALAR;
+#endif
+}
+
+const SimdLevel s_detected = detectLevel();
+SimdLevel s_level = s_detected;
+
+bool supported(SimdLevel level) {
+	if ( level == SimdLevel::SCALAR || level == s_detected ) {
+		return true;
+	}
+	return level == SimdLevel::SSE2 && s_detected == SimdLevel::AVX2;
+}
+
+// Scalar reference versions, also used for the tails of the vector loops
+
+template <typename T, typename S>
+void sumMinMaxScalar(const T *data, long n, S &sum, T &min, T &max) {
+	S localSum = 0;
+	T localMin = min, localMax = max;
+	for ( long ii=0; ii<n; ii++ ) {
+		localSum += data[ii];
+		localMin = std::min(localMin, data[ii]);
+		localMax = std::max(localMax, data[ii]);
+	}
+	sum += localSum;
+	min = localMin;
+	max = localMax;
+}
+
+void swapBytes16Scalar(const uint8_t *src, uint16_t *dst, long n, uint16_t flip) {
+	for ( long ii=0; ii<n; ii++ ) {
+		dst[ii] = ((src[2*ii] << 8) | src[2*ii + 1]) ^ flip;
+	}
+}
+
+void swapBytes32Scalar(const uint8_t *src, uint32_t *dst, long n) {
+	for ( long ii=0; ii<n; ii++ ) {
+		dst[ii] = ((uint32_t) src[4*ii] << 24) | ((uint32_t) src[4*ii + 1] << 16)
+			| ((uint32_t) src[4*ii + 2] << 8) | src[4*ii + 3];
+	}
+}
+
+#if defined(__x86_64__)
+
+// The 16 bit sums are formed on values shifted into the signed range with
+// madd, whose 32 bit lanes are flushed before they can overflow
+const long s_flushVectors = 1 << 14;
+
+void sumMinMaxSse2(const uint8_t *data, long n, uint64_t &sum, uint8_t &min, uint8_t &max) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	__m128i vmin = _mm_set1_epi8((char) min), vmax = _mm_set1_epi8((char) max);
+	long ii = 0;
+	for ( ; ii + 16 <= n; ii += 16 ) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + ii));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+		vmin = _mm_min_epu8(vmin, v);
+		vmax = _mm_max_epu8(vmax, v);
+	}
+	uint64_t sums[2];
+	uint8_t mins[16], maxs[16];
+	_mm_storeu_si128((__m128i *) sums, acc);
+	_mm_storeu_si128((__m128i *) mins, vmin);
+	_mm_storeu_si128((__m128i *) maxs, vmax);
+	sum += sums[0] + sums[1];
+	min = *std::min_element(mins, mins + 16);
+	max = *std::max_element(maxs, maxs + 16);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void sumMinMaxSse2(const uint16_t *data, long n, uint64_t &sum, uint16_t &min, uint16_t &max) {
+	const __m128i flip = _mm_set1_epi16((short) 0x8000);
+	const __m128i ones = _mm_set1_epi16(1);
+	// SSE2 only compares signed 16 bit values, which the flipped ones are
+	__m128i vmin = _mm_set1_epi16((short) (min ^ 0x8000));
+	__m128i vmax = _mm_set1_epi16((short) (max ^ 0x8000));
+	int64_t total = 0;
+	long ii = 0;
+	while ( ii + 8 <= n ) {
+		__m128i acc = _mm_setzero_si128();
+		long end = std::min(n - 8, ii + 8 * (s_flushVectors - 1));
+		for ( ; ii <= end; ii += 8 ) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (data + ii)), flip);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(v, ones));
+			vmin = _mm_min_epi16(vmin, v);
+			vmax = _mm_max_epi16(vmax, v);
+		}
+		int32_t sums[4];
+		_mm_storeu_si128((__m128i *) sums, acc);
+		total += (int64_t) sums[0] + sums[1] + sums[2] + sums[3];
+	}
+	uint16_t mins[8], maxs[8];
+	_mm_storeu_si128((__m128i *) mins, vmin);
+	_mm_storeu_si128((__m128i *) maxs, vmax);
+	for ( int ll=0; ll<8; ll++ ) {
+		min = std::min(min, (uint16_t) (mins[ll] ^ 0x8000));
+		max = std::max(max, (uint16_t) (maxs[ll] ^ 0x8000));
+	}
+	sum += total + 32768 * ii;
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void sumMinMaxSse2(const float *data, long n, double &sum, float &min, float &max) {
+	__m128d accLo = _mm_setzero_pd(), accHi = _mm_setzero_pd();
+	__m128 vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max);
+	long ii = 0;
+	for ( ; ii + 4 <= n; ii += 4 ) {
+		__m128 v = _mm_loadu_ps(data + ii);
+		accLo = _mm_add_pd(accLo, _mm_cvtps_pd(v));
+		accHi = _mm_add_pd(accHi, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		// Keeps vmin and vmax if v is NaN, like std::min and std::max
+		vmin = _mm_min_ps(v, vmin);
+		vmax = _mm_max_ps(v, vmax);
+	}
+	double sums[2];
+	float mins[4], maxs[4];
+	_mm_storeu_pd(sums, _mm_add_pd(accLo, accHi));
+	_mm_storeu_ps(mins, vmin);
+	_mm_storeu_ps(maxs, vmax);
+	sum += sums[0] + sums[1];
+	min = *std::min_element(mins, mins + 4);
+	max = *std::max_element(maxs, maxs + 4);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void swapBytes16Sse2(const uint8_t *src, uint16_t *dst, long n, uint16_t flip) {
+	const __m128i mask = _mm_set1_epi16((short) flip);
+	long ii = 0;
+	for ( ; ii + 8 <= n; ii += 8 ) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 2*ii));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) (dst + ii), _mm_xor_si128(v, mask));
+	}
+	swapBytes16Scalar(src + 2*ii, dst + ii, n - ii, flip);
+}
+
+void swapBytes32Sse2(const uint8_t *src, uint32_t *dst, long n) {
+	long ii = 0;
+	for ( ; ii + 4 <= n; ii += 4 ) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 4*ii));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) (dst + ii), v);
+	}
+	swapBytes32Scalar(src + 4*ii, dst + ii, n - ii);
+}
+
+__attribute__((target("avx2")))
+void sumMinMaxAvx2(const uint8_t *data, long n, uint64_t &sum, uint8_t &min, uint8_t &max) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+	__m256i vmin = _mm256_set1_epi8((char) min), vmax = _mm256_set1_epi8((char) max);
+	long ii = 0;
+	for ( ; ii + 32 <= n; ii += 32 ) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (data + ii));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+		vmin = _mm256_min_epu8(vmin, v);
+		vmax = _mm256_max_epu8(vmax, v);
+	}
+	uint64_t sums[4];
+	uint8_t mins[32], maxs[32];
+	_mm256_storeu_si256((__m256i *) sums, acc);
+	_mm256_storeu_si256((__m256i *) mins, vmin);
+	_mm256_storeu_si256((__m256i *) maxs, vmax);
+	sum += sums[0] + sums[1] + sums[2] + sums[3];
+	min = *std::min_element(mins, mins + 32);
+	max = *std::max_element(maxs, maxs + 32);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+__attribute__((target("avx2")))
+void sumMinMaxAvx2(const uint16_t *data, long n, uint64_t &sum, uint16_t &min, uint16_t &max) {
+	const __m256i flip = _mm256_set1_epi16((short) 0x8000);
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i vmin = _mm256_set1_epi16((short) min), vmax = _mm256_set1_epi16((short) max);
+	int64_t total = 0;
+	long ii = 0;
+	while ( ii + 16 <= n ) {
+		__m256i acc = _mm256_setzero_si256();
+		long end = std::min(n - 16, ii + 16 * (s_flushVectors - 1));
+		for ( ; ii <= end; ii += 16 ) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) (data + ii));
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_xor_si256(v, flip), ones));
+			vmin = _mm256_min_epu16(vmin, v);
+			vmax = _mm256_max_epu16(vmax, v);
+		}
+		int32_t sums[8];
+		_mm256_storeu_si256((__m256i *) sums, acc);
+		for ( auto value : sums ) {
+			total += value;
+		}
+	}
+	uint16_t mins[16], maxs[16];
+	_mm256_storeu_si256((__m256i *) mins, vmin);
+	_mm256_storeu_si256((__m256i *) maxs, vmax);
+	sum += total + 32768 * ii;
+	min = *std::min_element(mins, mins + 16);
+	max = *std::max_element(maxs, maxs + 16);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+__attribute__((target("avx2")))
+void sumMinMaxAvx2(const float *data, long n, double &sum, float &min, float &max) {
+	__m256d accLo = _mm256_setzero_pd(), accHi = _mm256_setzero_pd();
+	__m256 vmin = _mm256_set1_ps(min), vmax = _mm256_set1_ps(max);
+	long ii = 0;
+	for ( ; ii + 8 <= n; ii += 8 ) {
+		__m256 v = _mm256_loadu_ps(data + ii);
+		accLo = _mm256_add_pd(accLo, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+		accHi = _mm256_add_pd(accHi, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+		vmin = _mm256_min_ps(v, vmin);
+		vmax = _mm256_max_ps(v, vmax);
+	}
+	double sums[4];
+	float mins[8], maxs[8];
+	_mm256_storeu_pd(sums, _mm256_add_pd(accLo, accHi));
+	_mm256_storeu_ps(mins, vmin);
+	_mm256_storeu_ps(maxs, vmax);
+	sum += sums[0] + sums[1] + sums[2] + sums[3];
+	min = *std::min_element(mins, mins + 8);
+	max = *std::max_element(maxs, maxs + 8);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+__attribute__((target("avx2")))
+void swapBytes16Avx2(const uint8_t *src, uint16_t *dst, long n, uint16_t flip) {
+	const __m256i mask = _mm256_set1_epi16((short) flip);
+	const __m256i order = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	long ii = 0;
+	for ( ; ii + 16 <= n; ii += 16 ) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (src + 2*ii));
+		v = _mm256_shuffle_epi8(v, order);
+		_mm256_storeu_si256((__m256i *) (dst + ii), _mm256_xor_si256(v, mask));
+	}
+	swapBytes16Scalar(src + 2*ii, dst + ii, n - ii, flip);
+}
+
+__attribute__((target("avx2")))
+void swapBytes32Avx2(const uint8_t *src, uint32_t *dst, long n) {
+	const __m256i order = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	long ii = 0;
+	for ( ; ii + 8 <= n; ii += 8 ) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (src + 4*ii));
+		_mm256_storeu_si256((__m256i *) (dst + ii), _mm256_shuffle_epi8(v, order));
+	}
+	swapBytes32Scalar(src + 4*ii, dst + ii, n - ii);
+}
+
+#elif defined(__aarch64__)
+
+void sumMinMaxNeon(const uint8_t *data, long n, uint64_t &sum, uint8_t &min, uint8_t &max) {
+	uint64x2_t acc = vdupq_n_u64(0);
+	uint8x16_t vmin = vdupq_n_u8(min), vmax = vdupq_n_u8(max);
+	long ii = 0;
+	for ( ; ii + 16 <= n; ii += 16 ) {
+		uint8x16_t v = vld1q_u8(data + ii);
+		acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(v)));
+		vmin = vminq_u8(vmin, v);
+		vmax = vmaxq_u8(vmax, v);
+	}
+	sum += vaddvq_u64(acc);
+	min = vminvq_u8(vmin);
+	max = vmaxvq_u8(vmax);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void sumMinMaxNeon(const uint16_t *data, long n, uint64_t &sum, uint16_t &min, uint16_t &max) {
+	uint64x2_t acc = vdupq_n_u64(0);
+	uint16x8_t vmin = vdupq_n_u16(min), vmax = vdupq_n_u16(max);
+	long ii = 0;
+	for ( ; ii + 8 <= n; ii += 8 ) {
+		uint16x8_t v = vld1q_u16(data + ii);
+		acc = vpadalq_u32(acc, vpaddlq_u16(v));
+		vmin = vminq_u16(vmin, v);
+		vmax = vmaxq_u16(vmax, v);
+	}
+	sum += vaddvq_u64(acc);
+	min = vminvq_u16(vmin);
+	max = vmaxvq_u16(vmax);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void sumMinMaxNeon(const float *data, long n, double &sum, float &min, float &max) {
+	float64x2_t accLo = vdupq_n_f64(0), accHi = vdupq_n_f64(0);
+	float32x4_t vmin = vdupq_n_f32(min), vmax = vdupq_n_f32(max);
+	long ii = 0;
+	for ( ; ii + 4 <= n; ii += 4 ) {
+		float32x4_t v = vld1q_f32(data + ii);
+		accLo = vaddq_f64(accLo, vcvt_f64_f32(vget_low_f32(v)));
+		accHi = vaddq_f64(accHi, vcvt_high_f64_f32(v));
+		// Ignores NaN like std::min and std::max
+		vmin = vminnmq_f32(vmin, v);
+		vmax = vmaxnmq_f32(vmax, v);
+	}
+	sum += vaddvq_f64(vaddq_f64(accLo, accHi));
+	min = vminnmvq_f32(vmin);
+	max = vmaxnmvq_f32(vmax);
+	sumMinMaxScalar(data + ii, n - ii, sum, min, max);
+}
+
+void swapBytes16Neon(const uint8_t *src, uint16_t *dst, long n, uint16_t flip) {
+	const uint16x8_t mask = vdupq_n_u16(flip);
+	long ii = 0;
+	for ( ; ii + 8 <= n; ii += 8 ) {
+		uint16x8_t v = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2*ii)));
+		vst1q_u16(dst + ii, veorq_u16(v, mask));
+	}
+	swapBytes16Scalar(src + 2*ii, dst + ii, n - ii, flip);
+}
+
+void swapBytes32Neon(const uint8_t *src, uint32_t *dst, long n) {
+	long ii = 0;
+	for ( ; ii + 4 <= n; ii += 4 ) {
+		vst1q_u32(dst + ii, vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(src + 4*ii))));
+	}
+	swapBytes32Scalar(src + 4*ii, dst + ii, n - ii);
+}
+
+#endif
+
+}
+
+SimdLevel simdLevel() {
+	return s_level;
+}
+
+std::string simdLevelName() {
+	switch ( s_level ) {
+		case SimdLevel::SSE2:
+			return "sse2";
+		case SimdLevel::AVX2:
+			return "avx2";
+		case SimdLevel::NEON:
+			return "neon";
+		default:
+			return "scalar";
+	}
+}
+
+bool setSimdLevel(const std::string &name) {
+	static std::map<std::string, SimdLevel> map = {
+		{ "scalar", SimdLevel::SCALAR },
+		{ "sse2", SimdLevel::SSE2 },
+		{ "avx2", SimdLevel::AVX2 },
+		{ "neon", SimdLevel::NEON },
+	};
+	if ( ! map.count(name) ) {
+		return false;
+	}
+	s_level = supported(map[name]) ? map[name] : s_detected;
+	return true;
+}
+
+#if defined(__x86_64__)
+#define ELB_DISPATCH(name, ...) \
+	switch ( s_level ) { \
+		case SimdLevel::AVX2: \
+			name##Avx2(__VA_ARGS__); \
+			return; \
+		case SimdLevel::SSE2: \
+			name##Sse2(__VA_ARGS__); \
+			return; \
+		default: \
+			name##Scalar(__VA_ARGS__); \
+			return; \
+	}
+#elif defined(__aarch64__)
+#define ELB_DISPATCH(name, ...) \
+	if ( s_level == SimdLevel::NEON ) { \
+		name##Neon(__VA_ARGS__); \
+		return; \
+	} \
+	name##Scalar(__VA_ARGS__);
+#else
+#define ELB_DISPATCH(name, ...) \
+	name##Scalar(__VA_ARGS__);
+#endif
+
+void sumMinMax(const uint8_t *data, long n, uint64_t &sum, uint8_t &min, uint8_t &max) {
+	ELB_DISPATCH(sumMinMax, data, n, sum, min, max)
+}
+
+void sumMinMax(const uint16_t *data, long n, uint64_t &sum, uint16_t &min, uint16_t &max) {
+	ELB_DISPATCH(sumMinMax, data, n, sum, min, max)
+}
+
+void sumMinMax(const float *data, long n, double &sum, float &min, float &max) {
+	ELB_DISPATCH(sumMinMax, data, n, sum, min, max)
+}
+
+void swapBytes16(const uint8_t *src, uint16_t *dst, long n, uint16_t flip) {
+	ELB_DISPATCH(swapBytes16, src, dst, n, flip)
+}
+
+void swapBytes32(const uint8_t *src, uint32_t *dst, long n) {
+	ELB_DISPATCH(swapBytes32, src, dst, n)
+}
+
+}
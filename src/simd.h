@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace ELB {
+
+	// Vectorized versions of the per-pixel loops. The instruction set is
+	// picked once at runtime from what the CPU supports, so one x86 binary
+	// uses AVX2 where it is available. The scalar versions are the
+	// reference the others have to agree with.
+	enum class SimdLevel { SCALAR, SSE2, AVX2, NEON };
+
+	SimdLevel simdLevel();
+	std::string simdLevelName();
+	// Selects scalar, sse2, avx2 or neon. Levels the CPU doesn't support
+	// leave the detected one in place. Returns false for unknown names.
+	bool setSimdLevel(const std::string &name);
+
+	// Adds the n values to sum and widens [min, max] to include all of them
+	void sumMinMax(const uint8_t *data, long n, uint64_t &sum, uint8_t &min, uint8_t &max);
+	void sumMinMax(const uint16_t *data, long n, uint64_t &sum, uint16_t &min, uint16_t &max);
+	void sumMinMax(const float *data, long n, double &sum, float &min, float &max);
+	// Big-endian to native byte order. flip is xor'ed to the 16 bit results
+	// which turns the BZERO = 32768 convention into plain unsigned values.
+	void swapBytes16(const uint8_t *src, uint16_t *dst, long n, uint16_t flip);
+	void swapBytes32(const uint8_t *src, uint32_t *dst, long n);
+}
@@ -0,0 +1,183 @@
+#include "stars.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <opencv2/imgproc.hpp>
+
+namespace ELB {
+
+namespace {
+
+// Size of the cells the background is measured in
+const int s_meshSize = 64;
+// Detection threshold above the background in units of the noise
+const double s_detectSigma = 5;
+// Smaller blobs are hot pixels or noise, larger ones nebulae or galaxies
+const int s_minArea = 3;
+const int s_maxArea = 2500;
+// Blobs much longer than wide are satellite trails or hot columns
+const double s_maxElongation = 2.5;
+const int s_maxRadius = 32;
+
+float median(std::vector<float> &values) {
+	auto middle = values.begin() + values.size() / 2;
+	std::nth_element(values.begin(), middle, values.end());
+	return *middle;
+}
+
+// Median of every mesh cell, smoothed over the neighbouring cells so that a
+// cell filled by a large star or galaxy doesn't show, and interpolated back
+// to the size of the image
+cv::Mat backgroundMap(const cv::Mat &image) {
+	int meshRows = (image.rows + s_meshSize - 1) / s_meshSize;
+	int meshCols = (image.cols + s_meshSize - 1) / s_meshSize;
+	cv::Mat mesh(meshRows, meshCols, CV_32F);
+	TilePool::instance().run(meshRows, 1, [&](long row0, long row1, int) {
+		std::vector<float> values;
+		for ( long mr=row0; mr<row1; mr++ ) {
+			for ( int mc=0; mc<meshCols; mc++ ) {
+				cv::Rect cell(mc * s_meshSize, mr * s_meshSize,
+						std::min(s_meshSize, image.cols - mc * s_meshSize),
+						std::min(s_meshSize, image.rows - (int) mr * s_meshSize));
+				values.clear();
+				for ( int yy=cell.y; yy<cell.y+cell.height; yy++ ) {
+					const float *pixel = image.ptr<float>(yy) + cell.x;
+					values.insert(values.end(), pixel, pixel + cell.width);
+				}
+				mesh.at<float>(mr, mc) = median(values);
+			}
+		}
+	});
+	if ( meshRows >= 3 && meshCols >= 3 ) {
+		cv::medianBlur(mesh, mesh, 3);
+	}
+	cv::Mat background;
+	cv::resize(mesh, background, image.size(), 0., 0., cv::InterpolationFlags::INTER_LINEAR);
+	return background;
+}
+
+// Noise of the residual from every fourth pixel of every fourth row. Binned
+// frames can have less than one unit of noise, so it is measured on the
+// float values rather than in a histogram.
+double noise(const cv::Mat &residual) {
+	std::vector<float> values;
+	values.reserve((size_t) (residual.rows / 4 + 1) * (residual.cols / 4 + 1));
+	for ( int yy=0; yy<residual.rows; yy+=4 ) {
+		const float *pixel = residual.ptr<float>(yy);
+		for ( int xx=0; xx<residual.cols; xx+=4 ) {
+			values.push_back(pixel[xx]);
+		}
+	}
+	if ( values.empty() ) {
+		return 0;
+	}
+	float center = median(values);
+	for ( auto &value : values ) {
+		value = std::fabs(value - center);
+	}
+	return noiseFromMad(median(values));
+}
+
+// Radius around the flux weighted centre of the star that encloses half of
+// its flux. Only pixels more than one sigma above the background within the
+// aperture count, so the noise around faint stars doesn't add up to a larger
+// radius. The enclosed flux is interpolated linearly between the distances
+// of the pixel centres. Stars whose aperture doesn't fit into the image are
+// skipped.
+double halfFluxRadius(const cv::Mat &residual, double x, double y, int radius, double sigma) {
+	int x0 = (int) x - radius, x1 = (int) x + radius;
+	int y0 = (int) y - radius, y1 = (int) y + radius;
+	if ( x0 < 0 || y0 < 0 || x1 >= residual.cols || y1 >= residual.rows ) {
+		return NAN;
+	}
+	double flux = 0, cx = 0, cy = 0;
+	for ( int yy=y0; yy<=y1; yy++ ) {
+		const float *pixel = residual.ptr<float>(yy);
+		for ( int xx=x0; xx<=x1; xx++ ) {
+			if ( pixel[xx] > sigma ) {
+				flux += pixel[xx];
+				cx += pixel[xx] * xx;
+				cy += pixel[xx] * yy;
+			}
+		}
+	}
+	if ( flux <= 0 ) {
+		return NAN;
+	}
+	cx /= flux;
+	cy /= flux;
+	std::vector<std::pair<double, float>> rings;
+	flux = 0;
+	for ( int yy=y0; yy<=y1; yy++ ) {
+		const float *pixel = residual.ptr<float>(yy);
+		for ( int xx=x0; xx<=x1; xx++ ) {
+			double distance = std::hypot(xx - cx, yy - cy);
+			if ( pixel[xx] > sigma && distance <= radius ) {
+				rings.emplace_back(distance, pixel[xx]);
+				flux += pixel[xx];
+			}
+		}
+	}
+	if ( flux <= 0 ) {
+		return NAN;
+	}
+	std::sort(rings.begin(), rings.end());
+	double half = flux / 2, enclosed = 0, inner = 0;
+	for ( const auto &ring : rings ) {
+		if ( enclosed + ring.second >= half ) {
+			return inner + (ring.first - inner) * (half - enclosed) / ring.second;
+		}
+		enclosed += ring.second;
+		inner = ring.first;
+	}
+	return inner;
+}
+
+}
+
+StarField detectStars(const cv::Mat &image) {
+	if ( image.type() != CV_32F ) {
+		throw std::runtime_error("Stars can only be detected in single channel float images");
+	}
+	StarField field;
+	cv::Mat residual;
+	cv::subtract(image, backgroundMap(image), residual);
+	double sigma = noise(residual);
+	if ( sigma <= 0 ) {
+		// Flat or synthetic frame, there is nothing to measure against
+		return field;
+	}
+	cv::Mat mask = residual > s_detectSigma * sigma;
+	cv::Mat labels, stats, centroids;
+	int nLabels = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+	std::vector<float> hfrs;
+	// Label 0 is the background
+	for ( int ii=1; ii<nLabels; ii++ ) {
+		int area = stats.at<int>(ii, cv::CC_STAT_AREA);
+		int width = stats.at<int>(ii, cv::CC_STAT_WIDTH);
+		int height = stats.at<int>(ii, cv::CC_STAT_HEIGHT);
+		if ( area < s_minArea || area > s_maxArea ) {
+			continue;
+		}
+		if ( std::max(width, height) > s_maxElongation * std::min(width, height) ) {
+			continue;
+		}
+		// The wings of the star reach well beyond the part above the threshold
+		int radius = std::min(std::max(width, height), s_maxRadius);
+		double hfr = halfFluxRadius(residual, centroids.at<double>(ii, 0), centroids.at<double>(ii, 1), radius, sigma);
+		if ( ! std::isnan(hfr) ) {
+			hfrs.push_back(hfr);
+		}
+	}
+	field.count = hfrs.size();
+	if ( ! hfrs.empty() ) {
+		field.hfr = median(hfrs);
+	}
+	return field;
+}
+
+}
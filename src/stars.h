@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cmath>
+
+#include <opencv2/core.hpp>
+
+namespace ELB {
+
+	struct StarField {
+		long count = 0;
+		// Median half flux radius of the stars in pixels, NAN without stars
+		double hfr = NAN;
+	};
+
+	// Finds the stars of a single channel float image given in units of 16
+	// bits of the full scale. A map of the sky background is taken out first,
+	// what is left is thresholded at a few times the noise and every blob of
+	// a plausible size and shape counts as a star. Meant for binned working
+	// copies of a few megapixels.
+	StarField detectStars(const cv::Mat &image);
+}
@@ -0,0 +1,175 @@
+#include "stats.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace ELB {
+
+Histogram::Histogram(int depth) {
+	if ( depth != CV_8U && depth != CV_16U ) {
+		throw std::runtime_error("Histograms need 8 or 16 bit data");
+	}
+	m_bins.assign(depth == CV_8U ? 1 << 8 : 1 << 16, 0);
+}
+
+Histogram::Histogram(const cv::Mat &channel, long step) : Histogram(channel.depth()) {
+	if ( channel.channels() != 1 ) {
+		throw std::runtime_error("Histograms need single channel data");
+	}
+	step = std::max(step, 1L);
+	long pixels = (long) channel.total() / (step * step);
+	if ( pixels < s_parallelPixels ) {
+		accumulate(channel, 0, channel.rows, step);
+		return;
+	}
+	// Every worker fills its own histogram, they are merged at the end
+	TilePool &pool = TilePool::instance();
+	std::vector<Histogram> partial(pool.workers(), Histogram(channel.depth()));
+	long nRows = (channel.rows + step - 1) / step;
+	pool.run(nRows, s_tileRows, [&channel, &partial, step](long row0, long row1, int worker) {
+		partial[worker].accumulate(channel, row0 * step, std::min(row1 * step, (long) channel.rows), step);
+	});
+	for ( const auto &histogram : partial ) {
+		merge(histogram);
+	}
+}
+
+void Histogram::accumulate(const cv::Mat &channel, long row0, long row1, long step) {
+	for ( long ii=row0; ii<row1; ii+=step ) {
+		if ( channel.depth() == CV_8U ) {
+			add(channel.ptr<uint8_t>(ii), (channel.cols + step - 1) / step, step);
+		} else {
+			add(channel.ptr<uint16_t>(ii), (channel.cols + step - 1) / step, step);
+		}
+	}
+}
+
+void Histogram::add(const uint8_t *data, long n, long step) {
+	for ( long ii=0; ii<n; ii++ ) {
+		m_bins[data[ii * step]]++;
+	}
+	m_count += n;
+}
+
+void Histogram::add(const uint16_t *data, long n, long step) {
+	if ( m_bins.size() <= UINT8_MAX + 1 ) {
+		throw std::runtime_error("16 bit data added to an 8 bit histogram");
+	}
+	for ( long ii=0; ii<n; ii++ ) {
+		m_bins[data[ii * step]]++;
+	}
+	m_count += n;
+}
+
+void Histogram::merge(const Histogram &other) {
+	if ( other.m_bins.size() != m_bins.size() ) {
+		throw std::runtime_error("Can't merge histograms of different depths");
+	}
+	for ( size_t bb=0; bb<m_bins.size(); bb++ ) {
+		m_bins[bb] += other.m_bins[bb];
+	}
+	m_count += other.m_count;
+}
+
+uint64_t Histogram::count() const {
+	return m_count;
+}
+
+uint64_t Histogram::bin(int value) const {
+	return m_bins.at(value);
+}
+
+int Histogram::value(uint64_t rank) const {
+	uint64_t seen = 0;
+	for ( size_t bb=0; bb<m_bins.size(); bb++ ) {
+		seen += m_bins[bb];
+		if ( seen > rank ) {
+			return bb;
+		}
+	}
+	return m_bins.size() - 1;
+}
+
+int Histogram::median() const {
+	// Same as picking the middle element of the sorted pixels
+	return value(m_count / 2);
+}
+
+int Histogram::percentile(double fraction) const {
+	if ( m_count == 0 ) {
+		return 0;
+	}
+	fraction = std::min(std::max(fraction, 0.), 1.);
+	return value(std::min((uint64_t) (fraction * m_count), m_count - 1));
+}
+
+double Histogram::meanDeviation(double center) const {
+	if ( m_count == 0 ) {
+		return 0;
+	}
+	double sum = 0;
+	for ( size_t bb=0; bb<m_bins.size(); bb++ ) {
+		sum += m_bins[bb] * std::fabs(bb - center);
+	}
+	return sum / m_count;
+}
+
+int Histogram::medianDeviation(int center) const {
+	// Bins at distance d from the center hold the pixels with deviation d,
+	// walk outwards until half of them are covered
+	uint64_t rank = m_count / 2;
+	uint64_t seen = 0;
+	long nBins = m_bins.size();
+	for ( long dd=0; dd<nBins; dd++ ) {
+		if ( center + dd < nBins ) {
+			seen += m_bins[center + dd];
+		}
+		if ( dd > 0 && center - dd >= 0 ) {
+			seen += m_bins[center - dd];
+		}
+		if ( seen > rank ) {
+			return dd;
+		}
+	}
+	return nBins - 1;
+}
+
+double Histogram::noise() const {
+	return noiseFromMad(medianDeviation(median()));
+}
+
+double noiseFromMad(double mad) {
+	// The MAD of a normal distribution is 0.6745 sigma
+	return 1.4826 * mad;
+}
+
+StretchCache &StretchCache::instance() {
+	static StretchCache cache;
+	return cache;
+}
+
+bool StretchCache::get(const std::string &key, std::vector<Params> &params) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_entries.find(key);
+	if ( it == m_entries.end() ) {
+		return false;
+	}
+	it->second.used = ++m_uses;
+	params = it->second.params;
+	return true;
+}
+
+void StretchCache::put(const std::string &key, const std::vector<Params> &params) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if ( m_entries.find(key) == m_entries.end() && m_entries.size() >= s_maxEntries ) {
+		// Make room by forgetting the target that was seen last the longest ago
+		auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+				[](const auto &a, const auto &b) { return a.second.used < b.second.used; });
+		m_entries.erase(oldest);
+	}
+	m_entries[key] = Entry{params, ++m_uses};
+}
+
+}
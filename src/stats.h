@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace ELB {
+
+	// Standard deviation of normally distributed noise with the given median
+	// absolute deviation
+	double noiseFromMad(double mad);
+
+	// Exact histogram of a single channel 8 or 16 bit image, one bin per
+	// value. Order statistics come out of it in O(number of bins) without
+	// copying or sorting the pixels.
+	class Histogram {
+		public:
+			// Empty histogram for CV_8U or CV_16U data
+			explicit Histogram(int depth);
+			// Counts every step-th pixel of every step-th row, large images
+			// are counted by all cores
+			Histogram(const cv::Mat &channel, long step = 1);
+
+			// Counts n values, step apart
+			void add(const uint8_t *data, long n, long step = 1);
+			void add(const uint16_t *data, long n, long step = 1);
+			void merge(const Histogram &other);
+
+			uint64_t count() const;
+			// Number of pixels with the given value
+			uint64_t bin(int value) const;
+			// Value that ends up at position rank when sorting the pixels
+			int value(uint64_t rank) const;
+			int median() const;
+			// Value below which the given fraction of the pixels lie
+			int percentile(double fraction) const;
+			// Mean absolute deviation from center
+			double meanDeviation(double center) const;
+			// Median of the absolute deviations from center
+			int medianDeviation(int center) const;
+			// Standard deviation of normally distributed noise, estimated
+			// from the median absolute deviation from the median
+			double noise() const;
+		private:
+			static constexpr long s_parallelPixels = 1 << 20;
+			static constexpr long s_tileRows = 64;
+			void accumulate(const cv::Mat &channel, long row0, long row1, long step);
+
+			std::vector<uint64_t> m_bins;
+			uint64_t m_count = 0;
+	};
+
+	// Summary of the raw pixel values of a frame, in ADU
+	struct FrameStatistics {
+		double mean = 0;
+		double median = 0;
+		// Median absolute deviation from the median
+		double mad = 0;
+		double min = 0;
+		double max = 0;
+		// Fraction of the pixels at the largest value of the data type
+		double saturated = 0;
+		// Standard deviation of the background, see Histogram::noise()
+		double noise = 0;
+	};
+
+	// Stretch parameters of the last frame of every target, filter, exposure
+	// and gain. Frames of a sequence have nearly the same background, so a
+	// frame whose sampled median is close to the cached one can reuse the
+	// parameters instead of counting all of its pixels.
+	class StretchCache {
+		public:
+			// Values are scaled to [0, 1]. The cache keeps median and
+			// deviation in ADU instead, float frames are scaled by their own
+			// maximum.
+			struct Params {
+				float median;
+				float deviation;
+				float c0;
+				float m;
+			};
+
+			static StretchCache &instance();
+			StretchCache(const StretchCache &other) = delete;
+			StretchCache& operator=(const StretchCache &other) = delete;
+
+			// Parameters of every channel stored for the key, if any
+			bool get(const std::string &key, std::vector<Params> &params);
+			void put(const std::string &key, const std::vector<Params> &params);
+		private:
+			static constexpr size_t s_maxEntries = 16;
+			struct Entry {
+				std::vector<Params> params;
+				unsigned long used;
+			};
+
+			StretchCache() = default;
+
+			std::mutex m_mutex;
+			std::map<std::string, Entry> m_entries;
+			unsigned long m_uses = 0;
+	};
+}